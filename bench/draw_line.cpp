@@ -0,0 +1,82 @@
+// draw_line_circle against the circle stamping it replaced: the same pixels, and how long a page of
+// short segments takes at each brush width. best of 5 on a VirtualFB the size of the screen
+#include "../rmkit.h"
+#include <chrono>
+
+double now_ms(){
+  return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// what draw_line_circle did before: a filled circle of width/2 at every bresenham step, a pixel at a time
+void stamped_line(framebuffer::FB* fb,int x0,int y0,int x1,int y1,int width,int color){
+  fb->dirty = 1;
+  int r = width/2;
+  int dx = abs(x1-x0), sx = x0 < x1 ? 1 : -1;
+  int dy = -abs(y1-y0), sy = y0 < y1 ? 1 : -1;
+  int err = dx+dy;
+  while (true){
+    fb->update_dirty(fb->dirty_area,x0-r-1,y0-r-1);
+    fb->update_dirty(fb->dirty_area,x0+r+1,y0+r+1);
+    for (int x = -r ; x <= r ; x++)
+      for (int y = -r ; y <= r ; y++)
+        if (x*x+y*y <= r*r)
+          fb->_draw_rect_fast(x+x0,y+y0,1,1,color);
+    if (x0 == x1 && y0 == y1) break;
+    int e2 = 2*err;
+    if (e2 >= dy){
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx){
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+int main(){
+  auto a = new framebuffer::VirtualFB(1404,1872), b = new framebuffer::VirtualFB(1404,1872);
+  int pixels = a->width*a->height;
+
+  // random segments at every width and color, some running off the screen
+  srand(3);
+  int widths[] = {1,2,3,4,6,10,17,27};
+  for (int i = 0 ; i < 20000 ; i++){
+    int w = widths[rand()%8];
+    int x0 = rand()%1500-50, y0 = rand()%1970-50;
+    int x1 = x0+rand()%81-40, y1 = y0+rand()%81-40;
+    if (i%50 == 0){
+      x1 = rand()%1404;
+      y1 = rand()%1872;
+    }
+    int c = i%7 == 0 ? GRAY : i%2 ? BLACK : WHITE;
+    stamped_line(a,x0,y0,x1,y1,w,c);
+    b->draw_line_circle(x0,y0,x1,y1,w,c);
+  }
+  bool same = !memcmp(a->fbmem,b->fbmem,pixels*sizeof(remarkable_color));
+  printf("20k random segments: %s\n",same ? "same pixels" : "PIXELS DIFFER");
+
+  // a page of handwriting is mostly segments a few pixels long
+  std::vector<int> seg;
+  srand(5);
+  for (int i = 0 ; i < 20000 ; i++){
+    int x = rand()%1380, y = rand()%1800;
+    seg.insert(seg.end(),{x,y,x+rand()%12-6,y+rand()%12-6});
+  }
+  printf("20k short segments, ms   stamped   spans\n");
+  for (int w : {2,4,6,10,17,27}){
+    double best[2] = {1e9,1e9};
+    for (int run = 0 ; run < 5 ; run++){
+      double t = now_ms();
+      for (size_t i = 0 ; i < seg.size() ; i += 4)
+        stamped_line(a,seg[i],seg[i+1],seg[i+2],seg[i+3],w,BLACK);
+      best[0] = std::min(best[0],now_ms()-t);
+      t = now_ms();
+      for (size_t i = 0 ; i < seg.size() ; i += 4)
+        b->draw_line_circle(seg[i],seg[i+1],seg[i+2],seg[i+3],w,BLACK);
+      best[1] = std::min(best[1],now_ms()-t);
+    }
+    printf("  width %2d              %7.1f %7.1f\n",w,best[0],best[1]);
+  }
+  return same ? 0 : 1;
+}
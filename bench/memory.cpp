@@ -0,0 +1,58 @@
+// bytes per point a long page takes in memory, with the points pooled as 16 bit offsets from each stroke's
+// origin, against the segments in per row buckets that the grid held before
+#define main remarked_main
+#include "../main.cpp"
+#undef main
+
+// how the grid stored a page before, a segment per pair of points in one of 16 buckets per row
+struct old_segment{
+  int ax,ay,bx,by;
+  char width, color, type, etc;
+};
+struct old_row{
+  std::vector<old_segment> vect[16];
+  std::vector<file_link> links;
+};
+
+int main(){
+  const int w = 1404, h = 1824;
+  const int row_w = w/16+1, row_h = h/16+1;
+  const int pages = 3;
+  srand(7);
+  size_t points = 0, before = 0, after = 0;
+  for (int p = 0 ; p < pages ; p++){
+    page pg;
+    std::vector<old_row> rows;
+    // lines of 20 to 60 points down the page, like handwriting scrolled a few screens long
+    for (int i = 0 ; i < 1000 ; i++){
+      int x = rand()%(w-100), y = rand()%(h*4);
+      int n = 20+rand()%41;
+      stroke st;
+      st.width = 4;
+      st.begin(pg.pts,x,y);
+      for (int k = 1 ; k < n ; k++){
+        int nx = std::min(std::max(x+rand()%9-2,0),w-1), ny = std::max(y+rand()%7-3,0);
+        old_segment s{x,y,nx,ny,4,0,0,0};
+        int j = s.ay/row_h;
+        if (j >= (int)rows.size())
+          rows.resize(j+1);
+        rows[j].vect[s.ax/row_w].push_back(s);
+        x = nx;
+        y = ny;
+        st.add(pg.pts,x,y);
+      }
+      st.id = pg.next_id++;
+      pg.insert(st);
+      points += n;
+    }
+    before += sizeof(std::vector<old_row>) + rows.capacity()*sizeof(old_row);
+    for (old_row& r : rows)
+      for (auto& v : r.vect)
+        before += v.capacity()*sizeof(old_segment);
+    after += pg.bytes();
+  }
+  printf("%d pages, %zu points\n",pages,points);
+  printf("segments in row buckets  %8zu bytes  %5.1f bytes per point\n",before,(double)before/points);
+  printf("pooled 16 bit offsets    %8zu bytes  %5.1f bytes per point\n",after,(double)after/points);
+  return 0;
+}
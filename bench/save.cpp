@@ -0,0 +1,97 @@
+// how long saves take through page_writer with notes.db in WAL and group commit, against the rollback
+// journal in memory with synchronous off and a commit per save that it used before. best of 5
+#define main remarked_main
+#include "../main.cpp"
+#undef main
+#include <chrono>
+
+double now_ms(){
+  return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// n short strokes for a page, as a journal entry or as the whole page
+page_edit edit(int page,int n,bool compact){
+  page_edit e;
+  e.file = "Bench";
+  e.page = page;
+  e.next_id = n+1;
+  e.compact = compact;
+  for (int i = 0 ; i < n ; i++){
+    stroke st;
+    st.width = 4;
+    st.begin(e.pts,i*7%1400,i*13%1800);
+    st.add(e.pts,i*7%1400+3,i*13%1800+2);
+    st.add(e.pts,i*7%1400+6,i*13%1800+1);
+    st.id = i+1;
+    e.added.push_back(st);
+  }
+  return e;
+}
+
+struct times{
+  double journal = 1e9, compact = 1e9, burst = 1e9, checkpoint = 1e9;
+};
+
+void run(bool wal,times& t){
+  page_writer w;
+  w.start();
+  sql_exec(w.db,wal ? "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;" : "PRAGMA journal_mode = MEMORY; PRAGMA synchronous = OFF;");
+  std::vector<page_edit> small, big;
+  for (int i = 0 ; i < 200 ; i++)
+    small.push_back(edit(i%20,100,false));
+  for (int i = 0 ; i < 20 ; i++)
+    big.push_back(edit(i,5000,true));
+
+  // a save per page turn, each waited on
+  double s = now_ms();
+  for (page_edit& e : small){
+    w.push(page_edit(e));
+    w.flush();
+  }
+  t.journal = std::min(t.journal,(now_ms()-s)/small.size());
+  s = now_ms();
+  for (page_edit& e : big){
+    w.push(page_edit(e));
+    w.flush();
+  }
+  t.compact = std::min(t.compact,(now_ms()-s)/big.size());
+
+  // saves that come faster than they commit, before they were a commit each
+  s = now_ms();
+  for (page_edit& e : small){
+    w.push(page_edit(e));
+    if (!wal) w.flush();
+  }
+  w.flush();
+  t.burst = std::min(t.burst,now_ms()-s);
+
+  if (wal){
+    s = now_ms();
+    w.checkpoint(true);
+    w.flush();
+    t.checkpoint = std::min(t.checkpoint,now_ms()-s);
+  }
+  w.stop();
+}
+
+int main(int argc,char** argv){
+  db_path = argc > 1 ? argv[1] : "bench_save.db";
+  remove(db_path);
+  // grid makes the tables
+  grid g;
+  g.init(1824,48,new framebuffer::VirtualFB(1404,1872));
+  g.close();
+
+  times before, after;
+  for (int i = 0 ; i < 5 ; i++){
+    run(false,before);
+    run(true,after);
+  }
+  printf("ms                         MEMORY/OFF   WAL/NORMAL\n");
+  printf("100 stroke journal save    %9.2f %12.2f\n",before.journal,after.journal);
+  printf("5000 stroke compaction     %9.2f %12.2f\n",before.compact,after.compact);
+  printf("200 saves in a burst       %9.2f %12.2f\n",before.burst,after.burst);
+  printf("truncating checkpoint      %9s %12.2f\n","-",after.checkpoint);
+  remove(db_path);
+  return 0;
+}
@@ -1,73 +1,845 @@
 #include "rmkit.h"
 #include <tuple>
 #include <vector>
+#include <unordered_set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <climits>
 
 #include "sqlite3.h"
 #include <cstdio>
 
+struct point{
+  int x,y;
+  bool operator==(const point& p) const {return x == p.x && y == p.y;}
+};
+
+// bounding boxes, inclusive on all sides
+struct box{
+  int x0,y0,x1,y1;
+  bool overlaps(const box& b) const {return x0 <= b.x1 && b.x0 <= x1 && y0 <= b.y1 && b.y0 <= y1;}
+};
+
+// the points of every stroke on a page, xs and ys apart and each stroke's in one run.
+// they are 16 bit offsets from the stroke's origin, which is plenty for a line drawn on one screen.
+// ps is how hard the pen pressed at each point, as how much of the brush width it gets out of 255
+struct point_pool{
+  std::vector<short> xs, ys;
+  std::vector<unsigned char> ps;
+
+  unsigned int size() const {return (unsigned int)xs.size();}
+  void reserve(size_t n){
+    xs.reserve(n);
+    ys.reserve(n);
+    ps.reserve(n);
+  }
+  void clear(){
+    xs.clear();
+    ys.clear();
+    ps.clear();
+  }
+  size_t bytes() const {return (xs.capacity() + ys.capacity())*sizeof(short) + ps.capacity();}
+};
+
+// everything drawn between pen down and pen up, one point is a dot.
+// the points live in a point_pool the stroke doesn't own, the page's or the pen's
 struct stroke{
-  int ax,ay,bx,by;
-  char width, color, type, etc;
+  int x = 0, y = 0; // origin, the pool holds points relative to it
+  unsigned int first = 0, n = 0; // where the points are in the pool
+  box bb = box{INT_MAX,INT_MAX,INT_MIN,INT_MIN};
+  unsigned int id = 0; // stable within a page, tombstones in the journal refer to it
+  char width = 0, color = 0, type = 0, etc = 0;
+
+  // starts the points at the end of the pool, add has to be called before anything else goes in it
+  void begin(point_pool& pool,int px,int py,unsigned char pressure = 255){
+    x = px;
+    y = py;
+    first = pool.size();
+    n = 0;
+    bb = stroke().bb;
+    add(pool,px,py,pressure);
+  }
+
+  // false if the point is too far from the origin, it has to start another stroke then
+  bool add(point_pool& pool,int px,int py,unsigned char pressure = 255){
+    int dx = px-x, dy = py-y;
+    if (dx != (short)dx || dy != (short)dy) return false;
+    pool.xs.push_back((short)dx);
+    pool.ys.push_back((short)dy);
+    pool.ps.push_back(pressure);
+    n++;
+    grow(px,py);
+    return true;
+  }
+
+  void grow(int px,int py){
+    bb = box{std::min(bb.x0,px),std::min(bb.y0,py),std::max(bb.x1,px),std::max(bb.y1,py)};
+  }
+
+  point at(const point_pool& pool,int i) const {return point{x+pool.xs[first+i],y+pool.ys[first+i]};}
+  point last(const point_pool& pool) const {return at(pool,n-1);}
+
+  // points i to j, sharing their storage with this one
+  stroke slice(const point_pool& pool,int i,int j) const {
+    stroke s = *this;
+    s.first = first+i;
+    s.n = j-i+1;
+    s.id = 0;
+    s.bb = stroke().bb;
+    for (int k = i ; k <= j ; k++){
+      point p = at(pool,k);
+      s.grow(p.x,p.y);
+    }
+    return s;
+  }
 
-  void undraw(framebuffer::FB* fb,int y_scroll,int y){
-    if (ay < y_scroll || by < y_scroll) return;
-    fb->draw_line_circle(ax,y+ay-y_scroll,bx,y+by-y_scroll,width,WHITE);
+  // appends the points to another pool and points there from now on
+  void copy_to(const point_pool& from,point_pool& to){
+    unsigned int f = to.size();
+    to.xs.insert(to.xs.end(),from.xs.begin()+first,from.xs.begin()+first+n);
+    to.ys.insert(to.ys.end(),from.ys.begin()+first,from.ys.begin()+first+n);
+    to.ps.insert(to.ps.end(),from.ps.begin()+first,from.ps.begin()+first+n);
+    first = f;
+  }
+
+  // the box the brush covers, half its width past the points
+  box drawn() const {
+    int r = width/2 + 1;
+    return box{bb.x0-r,bb.y0-r,bb.x1+r,bb.y1+r};
+  }
+
+  // segment i joins point i to the next, a dot is its own segment
+  int segments() const {return n > 1 ? (int)n-1 : (int)n;}
+
+  // half the brush width, less where the pen pressed lightly. a brush wider than a pixel
+  // stays wider than one, a one pixel brush keeps radius 0 like it always had. full pressure
+  // is most points and skips the float math, it comes out the same
+  float radius(const point_pool& pool,int i) const {
+    int half = width/2;
+    unsigned char p = pool.ps[first+i];
+    if (!half || p == 255) return half;
+    return std::max(0.5f,half*p/255.0f);
+  }
+
+  // points i to j as one shape, nothing goes above the widget's top at y
+  void draw_points(framebuffer::FB* fb,const point_pool& pool,int i,int j,int y_scroll,int y,int c){
+    fb->draw_polyline(j-i+1,[&](int k,int& px,int& py,float& r){
+      point p = at(pool,i+k);
+      px = p.x;
+      py = y+p.y-y_scroll;
+      r = radius(pool,i+k);
+    },c,y);
+  }
+
+  void draw_segment(framebuffer::FB* fb,const point_pool& pool,int i,int y_scroll,int y,int c){
+    draw_points(fb,pool,i,i+1 < (int)n ? i+1 : i,y_scroll,y,c);
+  }
+
+  void undraw(framebuffer::FB* fb,const point_pool& pool,int y_scroll,int y){
+    draw_points(fb,pool,0,n-1,y_scroll,y,WHITE);
   }
   
-  void draw(framebuffer::FB* fb,int y_scroll,int y){
-    if (ay < y_scroll || by < y_scroll) return;
-    fb->draw_line_circle(ax,y+ay-y_scroll,bx,y+by-y_scroll,width,color::SCALE_16[(int)color]);
+  void draw(framebuffer::FB* fb,const point_pool& pool,int y_scroll,int y){
+    draw_points(fb,pool,0,n-1,y_scroll,y,color::SCALE_16[(int)color]);
   }
 };
 
+// a page's strokes are stored as one blob: a format byte, the stroke count, the next free
+// stroke id and then every stroke: its point count shifted up two (the low bit says
+// width/color/type/etc follow because they differ from the previous stroke's, the next one
+// that a byte of pressure per point comes after the points), its id relative to the previous
+// one and its points as zigzag varints relative to the point before, the first one
+// relative to where the previous stroke ended. most points take a byte or two.
+// version 3 had no pressure and shifted the count up one.
+// versions 1 and 2 stored two point segments with an id each (version 1 numbered them from
+// 1 in blob order), they come out one segment per stroke and join_segments puts lines back together
+const unsigned char stroke_blob_version = 4;
+
+inline unsigned int zigzag(int v){return ((unsigned int)v << 1) ^ (unsigned int)(v >> 31);}
+inline int unzigzag(unsigned int v){return (int)(v >> 1) ^ -(int)(v & 1);}
+
+struct stroke_packer{
+  std::vector<unsigned char> data;
+  int px = 0, py = 0;
+  unsigned int pid = 0;
+  char width = 0, color = 0, type = 0, etc = 0;
+
+  void put(unsigned int v){
+    while (v >= 0x80){
+      data.push_back((unsigned char)(v | 0x80));
+      v >>= 7;
+    }
+    data.push_back((unsigned char)v);
+  }
+
+  void begin(unsigned int count,unsigned int next_id){
+    data.clear();
+    data.reserve(count*16+16);
+    data.push_back(stroke_blob_version);
+    put(count);
+    put(next_id);
+    px = py = 0;
+    pid = 0;
+    width = color = type = etc = 0;
+  }
+
+  void add(const stroke& st,const point_pool& pool){
+    bool restyle = st.width != width || st.color != color || st.type != type || st.etc != etc;
+    bool pressed = false;
+    for (int i = 0 ; i < (int)st.n && !pressed ; i++)
+      pressed = pool.ps[st.first+i] != 255;
+    put(st.n << 2 | pressed << 1 | restyle);
+    put(zigzag((int)(st.id-pid)));
+    if (restyle){
+      data.push_back(width = st.width);
+      data.push_back(color = st.color);
+      data.push_back(type = st.type);
+      data.push_back(etc = st.etc);
+    }
+    for (int i = 0 ; i < (int)st.n ; i++){
+      point q = st.at(pool,i);
+      put(zigzag(q.x-px));
+      put(zigzag(q.y-py));
+      px = q.x;
+      py = q.y;
+    }
+    if (pressed)
+      data.insert(data.end(),pool.ps.begin()+st.first,pool.ps.begin()+st.first+st.n);
+    pid = st.id;
+  }
+};
+
+struct stroke_unpacker{
+  const unsigned char* p;
+  const unsigned char* end;
+  unsigned int count = 0, next_id = 1;
+  int px = 0, py = 0;
+  unsigned int pid = 0;
+  unsigned char version = 0;
+  char width = 0, color = 0, type = 0, etc = 0;
+
+  stroke_unpacker(const void* blob, int size){
+    p = (const unsigned char*)blob;
+    end = p + (blob ? size : 0);
+    if (p != end) version = *p++;
+    bool ok = version >= 1 && version <= stroke_blob_version && get(count);
+    if (ok && version == 1) next_id = count+1;
+    if (ok && version >= 2) ok = get(next_id);
+    if (!ok){
+      p = end;
+      count = 0;
+    }
+  }
+
+  // ids in old blobs belong to segments rather than strokes
+  bool segments() const {return version < 3;}
+
+  bool get(unsigned int& v){
+    v = 0;
+    for (int s = 0 ; s < 35 && p < end ; s += 7){
+      unsigned char b = *p++;
+      v |= (unsigned int)(b & 0x7f) << s;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool style(bool restyle){
+    if (restyle){
+      if (end - p < 4) return false;
+      width = (char)p[0];
+      color = (char)p[1];
+      type = (char)p[2];
+      etc = (char)p[3];
+      p += 4;
+    }
+    return true;
+  }
+
+  // the points go on the end of pool
+  bool next(stroke& st,point_pool& pool){
+    if (!count) return false;
+    unsigned int h,id = 1,x,y;
+    if (segments()){
+      unsigned int ay,bx,by;
+      if (!get(h) || !get(ay) || !get(bx) || !get(by)) return false;
+      if (version >= 2 && !get(id)) return false;
+      if (!style(h & 1)) return false;
+      int ax = px + unzigzag(h >> 1), ayy = py + unzigzag(ay);
+      st.begin(pool,ax,ayy);
+      px = ax + unzigzag(bx);
+      py = ayy + unzigzag(by);
+      if ((px != ax || py != ayy) && !st.add(pool,px,py)) return false;
+      st.id = pid = version >= 2 ? pid + unzigzag(id) : pid + 1;
+    } else {
+      if (!get(h) || !get(id) || !style(h & 1)) return false;
+      bool pressed = version >= 4 && (h & 2);
+      unsigned int n = version >= 4 ? h >> 2 : h >> 1;
+      if (!n || n > (unsigned int)(end-p)/2) return false;
+      for (unsigned int i = 0 ; i < n ; i++){
+        if (!get(x) || !get(y)) return false;
+        px += unzigzag(x);
+        py += unzigzag(y);
+        if (!i) st.begin(pool,px,py);
+        else if (!st.add(pool,px,py)) return false;
+      }
+      if (pressed){
+        if ((unsigned int)(end-p) < n) return false;
+        std::copy(p,p+n,pool.ps.begin()+st.first);
+        p += n;
+      }
+      st.id = pid += unzigzag(id);
+    }
+    st.width = width;
+    st.color = color;
+    st.type = type;
+    st.etc = etc;
+    count--;
+    return true;
+  }
+};
+
+// segments from an old blob become strokes again: a segment carries on the stroke before
+// it when it starts where that one ended in the same style. the stroke keeps the id of its
+// first segment, dead segments are dropped beforehand
+inline void join_segments(std::vector<stroke>& segs,const point_pool& from,const std::unordered_set<unsigned int>& dead,
+    std::vector<stroke>& out,point_pool& pool){
+  stroke* last = nullptr;
+  for (stroke& s : segs){
+    if (!dead.empty() && dead.count(s.id)) {
+      last = nullptr;
+      continue;
+    }
+    point a = s.at(from,0), b = s.last(from);
+    if (last && last->last(pool) == a && last->width == s.width && last->color == s.color
+        && last->type == s.type && last->etc == s.etc)
+      if (s.n < 2 || last->add(pool,b.x,b.y)) continue;
+    stroke t = s;
+    t.begin(pool,a.x,a.y);
+    if (s.n > 1) t.add(pool,b.x,b.y);
+    out.push_back(t);
+    last = &out.back();
+  }
+}
+
 struct file_link{
   int x,y,w;
   std::string file;
 };
-struct grid_row{
-  std::vector<stroke> vect[16];
-  std::vector<file_link> links;
-};
 
+// documents and pages are looked up by name and number once, everything else is keyed by the page id.
+// a page's number is its position in its document ordered by ord, see page_list
+const char* find_page_str = "select p.id from pages p join documents d on d.id = p.doc where d.name = ? order by p.ord limit 1 offset ?;";
+const char* nth_page_str = "select id, ord from pages where doc = ? order by ord limit 1 offset ?;";
+const char* last_page_str = "select count(*), max(ord) from pages where doc = ?;";
+const char* add_page_str = "insert into pages (doc, ord) values (?, ?);";
+const char* set_page_str = "update pages set doc = ?, ord = ? where id = ?;";
+// the ranks are taken before any ord changes, a subquery on pages would see the rows already renumbered
+const char* renumber_pages_str =
+"update pages set ord = r.n * ?2 from (select id, row_number() over (order by ord) - 1 as n from pages where doc = ?1) r "
+"where pages.id = r.id;";
+const char* find_doc_str = "select id from documents where name = ?;";
+const char* add_doc_str = "insert or ignore into documents (name) values (?);";
+// the pages with a link to a document and their numbers, through file_links_to
+const char* backlinks_str =
+"select d.name, (select count(*) from pages q where q.doc = p.doc and q.ord < p.ord) from file_links l "
+"join pages p on p.id = l.page_id join documents d on d.id = p.doc "
+"where l.to_doc = (select id from documents where name = ?) group by l.page_id order by d.name, p.ord;";
+
+const char* read_st_str = "select data from page_strokes where page_id=?;";
+const char* write_st_str = "insert or replace into page_strokes (page_id, data) values (?, ?);";
+
+const char* write_link_str = "insert into file_links (page_id, to_doc, x, y, w) values (?, ?, ?, ?, ?);";
+const char* read_link_str = "select d.name, l.x, l.y, l.w from file_links l join documents d on d.id = l.to_doc where l.page_id=?;";
 
-const char* read_st_str = "select ax, ay, bx, by, size, color, type, etc from pen_strokes where file=? and page=?;";
-const char* write_st_str = "insert into pen_strokes (file, page, ax, ay, bx, by, size, color, type, etc) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+const char* clear_st_str = 
+"delete from page_strokes where page_id=?;";
+const char* remove_link_str =
+"delete from file_links where rowid = (select rowid from file_links where page_id=? and to_doc=? and x=? and y=? limit 1);";
 
-const char* write_link_str = "insert into file_links (file, page, to_file, to_page, x, y) values (?, ?, ?, ?, ?, ?);";
-const char* read_link_str = "select to_file, to_page, x, y from file_links where file=? and page=?;";
+// strokes added and erased since page_strokes was last rewritten, one row per save
+const char* read_journal_str = "select data from stroke_journal where page_id=? order by rowid;";
+const char* write_journal_str = "insert into stroke_journal (page_id, data) values (?, ?);";
+const char* clear_journal_str = 
+"delete from stroke_journal where page_id=?;";
 
-const char* clear_st_str = 
-"delete from pen_strokes where file=? and page=?;";
-const char* clear_link_str =
-"delete from file_links where file=? and page=?;";
 
+const char* db_path = "/home/root/notes.db";
+// the ui and the writer thread each have a connection, one waits this long (ms) for the other's lock
+const int busy_timeout = 5000;
 
+// WAL keeps a page intact if the power goes mid save, commits only append to the log and
+// the log is folded into notes.db when idle or going to sleep rather than every 1000 pages
 const char* init_st_str = 
-"PRAGMA synchronous = OFF;\n"
-"PRAGMA journal_mode = MEMORY;\n"
+"PRAGMA journal_mode = WAL;\n"
+"create table if not exists schema_version (version int) strict;\n"
+"insert into schema_version select 0 where not exists (select 1 from schema_version);";
+
+// per connection, both the ui and the writer run it
+const char* connection_str =
+"PRAGMA synchronous = NORMAL;\n"
+"PRAGMA wal_autocheckpoint = 0;";
+
+// how long (ms) after the pen was last lifted the page is saved and checkpointed
+const int idle_ms = 3000;
+
+// upkeep the writer thread does when the pen is idle and before closing for sleep, a step
+// at a time and dropping a step as soon as something is waiting to be saved or read.
+// only sleep checks the tables, the rest is cheap when there is nothing to do
+const char* vacuum_step_str = "PRAGMA incremental_vacuum(64);";
+const char* optimize_str =
+"PRAGMA analysis_limit = 400;\n"
+"PRAGMA optimize;";
+const char* db_stats_str = "select (select page_count from pragma_page_count()), (select freelist_count from pragma_freelist_count()), (select page_size from pragma_page_size());";
+const char* checked_tables[] = {"documents","pages","page_strokes","stroke_journal","file_links"};
+const int num_checked_tables = sizeof(checked_tables)/sizeof(checked_tables[0]);
+// checking reads every table, so it is the first sleep after an upgrade and then one sleep in this many
+const int sleeps_per_check = 16;
+
+const char* read_version_str = "select version from schema_version;";
+const char* write_version_str = "update schema_version set version = ?;";
+
+// the schema is upgraded one version at a time by grid::migrate, the version a database
+// is at lives in schema_version. databases from before that table start at 0, which is
+// why the early steps all check whether they were already done
+const int schema_version = 8;
+
+const char* create_tables_str =
 "create table if not exists file_links (file text, page int, to_file text, to_page int, x int, y int) strict;\n" // I have to_page just incase but frankly I don't want to use it cause it'll cause a lot of problems with inaccurate links once I have page deleting
-"create table if not exists pen_strokes (file text, page int, ax int, ay int, bx int, by int, size int, color int, type int, etc int) strict;";
+"create table if not exists page_strokes (file text, page int, data blob) strict;\n"
+"create table if not exists stroke_journal (file text, page int, data blob) strict;";
+
+// every query is by file and page, the link one covers the whole row so it never touches the table
+const char* create_indexes_str =
+"create index if not exists file_links_page on file_links (file, page, to_file, to_page, x, y);\n"
+"create index if not exists page_strokes_page on page_strokes (file, page);\n"
+"create index if not exists stroke_journal_page on stroke_journal (file, page);";
+
+// old databases kept one row per segment, they get packed into page_strokes once on open
+const char* has_pen_strokes_str =
+"select 1 from sqlite_master where type = 'table' and name = 'pen_strokes';";
+const char* read_pen_strokes_str =
+"select file, page, ax, ay, bx, by, size, color, type, etc from pen_strokes order by file, page, rowid;";
+const char* pack_pen_strokes_str = "insert into page_strokes (file, page, data) values (?, ?, ?);";
+
+// every row used to carry its document's name, now names live once in documents and rows
+// point at pages by id. to_page was never used so links lose it
+const char* intern_documents_str =
+"create table documents (id integer primary key, name text not null unique) strict;\n"
+"create table pages (id integer primary key, doc int not null, page int not null) strict;\n"
+"insert or ignore into documents (name) select file from page_strokes union select file from stroke_journal union select file from file_links union select to_file from file_links;\n"
+"insert into pages (doc, page) select d.id, p.page from (select file, page from page_strokes union select file, page from stroke_journal union select file, page from file_links) p join documents d on d.name = p.file;\n"
+"create table new_strokes (page_id integer primary key, data blob) strict;\n"
+"insert or replace into new_strokes select p.id, s.data from page_strokes s join documents d on d.name = s.file join pages p on p.doc = d.id and p.page = s.page order by s.rowid;\n"
+"create table new_journal (page_id int, data blob) strict;\n"
+"insert into new_journal select p.id, j.data from stroke_journal j join documents d on d.name = j.file join pages p on p.doc = d.id and p.page = j.page order by j.rowid;\n"
+"create table new_links (page_id int, to_doc int, x int, y int) strict;\n"
+"insert into new_links select p.id, t.id, l.x, l.y from file_links l join documents d on d.name = l.file join pages p on p.doc = d.id and p.page = l.page join documents t on t.name = l.to_file order by l.rowid;\n"
+"drop table page_strokes;\n"
+"drop table stroke_journal;\n"
+"drop table file_links;\n"
+"alter table new_strokes rename to page_strokes;\n"
+"alter table new_journal rename to stroke_journal;\n"
+"alter table new_links rename to file_links;\n"
+"create index pages_doc on pages (doc, page);\n"
+"create index stroke_journal_page on stroke_journal (page_id);\n"
+"create index file_links_page on file_links (page_id, to_doc, x, y);";
+
+
+// pages are ordered by a key with room between neighbours instead of by their number, so
+// moving one is a single update. the empty pages numbers used to skip get rows so positions line up
+const char* order_pages_str =
+"with recursive n(doc, i) as (select doc, 0 from pages group by doc union all select n.doc, n.i+1 from n where n.i < (select max(page) from pages where doc = n.doc))\n"
+"insert into pages (doc, page) select doc, i from n where not exists (select 1 from pages p where p.doc = n.doc and p.page = n.i);\n"
+"alter table pages rename column page to ord;\n"
+"update pages set ord = ord * 1048576;";
+
+// pages freed by deletes go back to the filesystem a few at a time from page_writer::maintain
+// rather than only with a full VACUUM, the VACUUM after upgrading is what switches it on
+const char* auto_vacuum_str = "PRAGMA auto_vacuum = INCREMENTAL;";
+
+// links keep how wide their name is drawn at link_size so loading a page never measures text.
+// links to the same document have the same name so old ones are measured once per document
+const char* link_width_str = "alter table file_links add column w int;";
+const char* link_names_str = "select distinct d.id, d.name from file_links l join documents d on d.id = l.to_doc;";
+const char* set_link_width_str = "update file_links set w = ? where to_doc = ?;";
+
+// links are looked up backwards by the document they go to, see page_list::linked_from
+const char* backlinks_index_str = "create index file_links_to on file_links (to_doc, page_id);";
+
+// gap between the order keys of pages appended to a document
+const sqlite3_int64 page_gap = 1 << 20;
+
+
 
+const int link_size = 32;
+// decoded pages kept after they are left, a page of 20k segments is about 600k
+const size_t page_cache_bytes = 16 << 20;
+// the journal gets folded back into page_strokes once it has this many saves or holds
+// more than half as many strokes and tombstones as the page has strokes
+const int max_journal_len = 32;
+// a light touch draws min_pressure_width of the brush width, pressing full_pressure or harder draws all of it
+const float min_pressure_width = 0.35f;
+const float full_pressure = 0.6f;
+// the widest brush. strokes are indexed by their points, drawing and erasing look this far around them
+const int max_width = 27;
+// undo keeps the points of everything erased, the oldest steps go once it holds more than this
+const size_t undo_log_bytes = 1 << 20;
 
-const char* shift_st_str = 
-"update pen_strokes set page = page + ?3 where file = ?1 and page >= ?2;";
+inline int lensq(int x,int y){return x*x+y*y;}
+inline int min(int x,int y){return x<y?x:y;}
+inline int max(int x,int y){return x>y?x:y;}
 
-const char* setpage_st_str = 
-"update pen_strokes set file = ?3, page = ?4 where file = ?1 and page = ?2;";
+// squared distance from p to the segment a-b
+inline double dist_sq(point p,point a,point b){
+  double dx = b.x-a.x, dy = b.y-a.y, l = dx*dx+dy*dy;
+  double t = l > 0 ? ((p.x-a.x)*dx + (p.y-a.y)*dy)/l : 0;
+  t = t < 0 ? 0 : t > 1 ? 1 : t;
+  double ex = a.x + t*dx - p.x, ey = a.y + t*dy - p.y;
+  return ex*ex + ey*ey;
+}
 
-const char* shift_link_str = 
-"update file_links set page = page + ?3 where file = ?1 and page >= ?2;";
+// which side of a-b c is on, 0 if it is on the line
+inline int side(point a,point b,point c){
+  long long v = (long long)(b.x-a.x)*(c.y-a.y) - (long long)(b.y-a.y)*(c.x-a.x);
+  return (v > 0) - (v < 0);
+}
 
-const char* setpage_link_str = 
-"update file_links set file = ?3, page = ?4 where file = ?1 and page = ?2;";
+// whether p is inside the polygon, its last point joins its first
+inline bool inside(const std::vector<point>& poly,point p){
+  bool in = false;
+  for (size_t i = 0, j = poly.size()-1 ; i < poly.size() ; j = i++){
+    const point& a = poly[i];
+    const point& b = poly[j];
+    if ((a.y > p.y) != (b.y > p.y) && p.x < a.x + (double)(b.x-a.x)*(p.y-a.y)/(b.y-a.y))
+      in = !in;
+  }
+  return in;
+}
 
+inline box join(const box& a,const box& b){
+  return box{std::min(a.x0,b.x0),std::min(a.y0,b.y0),std::max(a.x1,b.x1),std::max(a.y1,b.y1)};
+}
 
+// squared distance between the segments a-b and c-d, 0 if they cross
+inline double dist_sq(point a,point b,point c,point d){
+  if (side(a,b,c)*side(a,b,d) < 0 && side(c,d,a)*side(c,d,b) < 0) return 0;
+  return std::min(std::min(dist_sq(a,c,d),dist_sq(b,c,d)),std::min(dist_sq(c,a,b),dist_sq(d,a,b)));
+}
 
-const int link_size = 32;
+// quadtree nodes split once they hold more than this many items, down to this size in pixels.
+// the root covers a page and doubles whenever something lands outside it, only the nodes
+// on the way to what is drawn get made so writing far down a page costs a few nodes per
+// doubling. past quad_max_size it stops growing before coordinates overflow, anything
+// outside stays in the root
+const int quad_node_max = 64;
+const int quad_min_size = 4;
+const int quad_root_size = 2048;
+const int quad_max_size = 1 << 29;
+
+inline box bounds(const stroke& st){
+  return st.bb;
+}
+// on the ui thread, stbtext isn't safe to use from the writer
+inline int link_width(const std::string& name){
+  return stbtext::get_text_size(name.c_str(),link_size).w;
+}
+// where a tap opens the link
+inline box bounds(const file_link& l){
+  return box{l.x-10,l.y-link_size-10,l.x+l.w+10,l.y+10};
+}
 
-inline int lensq(int x,int y){return x*x+y*y;}
-inline int min(int x,int y){return x<y?x:y;}
-inline int max(int x,int y){return x>y?x:y;}
+// everything on a page is found by rectangle through one of these. it is a loose quadtree:
+// a node's items may hang over its edges by half its size, an item goes down to the child
+// its centre is in for as long as it fits that child's overhang. small strokes end up in
+// small nodes wherever they are, so a query only looks at the few nodes around it however
+// crowded the rest of the page is.
+// all the items are kept in one vector, each node has a slice of it. a full slice moves to
+// the end with room to spare and the whole thing is rebuilt once it is mostly gaps, so a
+// page is two allocations however many nodes it has and freeing it is just as quick
+template<class T>
+struct quadtree{
+  struct node{
+    int x,y,size;
+    int child[4] = {-1,-1,-1,-1}; // quarters left to right then top to bottom, -1 on leaves
+    int first = 0, n = 0, cap = 0; // items[first] to items[first+n-1], with room for cap
+  };
+  std::vector<node> nodes;
+  std::vector<T> items;
+  std::vector<signed char> to; // where split sends each item, kept between splits
+  int root = -1;
+  int count = 0;
+
+  void clear(){
+    nodes.clear();
+    items.clear();
+    root = -1;
+    count = 0;
+  }
+
+  // where the items of n can be
+  static box area(const node& n){
+    int m = n.size/2;
+    return box{n.x-m,n.y-m,n.x+n.size+m-1,n.y+n.size+m-1};
+  }
+
+  static bool fits(const node& n,const box& b){
+    box a = area(n);
+    return b.x0 >= a.x0 && b.y0 >= a.y0 && b.x1 <= a.x1 && b.y1 <= a.y1;
+  }
+
+  // which quarter of n b goes down to, -1 if it stays in n
+  int quarter(const node& n,const box& b){
+    int mx = n.x + n.size/2, my = n.y + n.size/2;
+    int q = ((b.x0+b.x1)/2 >= mx) + 2*((b.y0+b.y1)/2 >= my);
+    return fits(nodes[n.child[q]],b) ? q : -1;
+  }
+
+  int add_node(int x,int y,int size){
+    nodes.push_back(node{x,y,size});
+    return (int)nodes.size()-1;
+  }
+
+  // the old root becomes the quarter of a new one facing away from b
+  void grow(const box& b){
+    node r = nodes[root];
+    int x = b.x0 < r.x ? r.x - r.size : r.x;
+    int y = b.y0 < r.y ? r.y - r.size : r.y;
+    int n = add_node(x,y,r.size*2);
+    for (int k = 0 ; k < 4 ; k++){
+      int cx = x + (k&1)*r.size, cy = y + (k>>1)*r.size;
+      int c = cx == r.x && cy == r.y ? root : add_node(cx,cy,r.size);
+      nodes[n].child[k] = c;
+    }
+    root = n;
+  }
+
+  void divide(int n){
+    int half = nodes[n].size/2;
+    for (int k = 0 ; k < 4 ; k++){
+      int c = add_node(nodes[n].x + (k&1)*half,nodes[n].y + (k>>1)*half,half);
+      nodes[n].child[k] = c;
+    }
+  }
+
+  // sorts the slice of n into what stays and each quarter's, in place, and hands the
+  // quarters their part of it
+  void split(int n){
+    divide(n);
+    int first = nodes[n].first, len = nodes[n].n;
+    to.resize(len);
+    int start[6] = {0,0,0,0,0,0};
+    for (int k = 0 ; k < len ; k++)
+      start[(to[k] = quarter(nodes[n],bounds(items[first+k]))+1)+1]++;
+    for (int b = 1 ; b < 6 ; b++)
+      start[b] += start[b-1];
+    int at[5];
+    for (int b = 0 ; b < 5 ; b++)
+      at[b] = start[b];
+    for (int b = 0 ; b < 5 ; b++)
+      while (at[b] < start[b+1]){
+        int d = to[at[b]];
+        if (d == b){
+          at[b]++;
+          continue;
+        }
+        std::swap(items[first+at[b]],items[first+at[d]]);
+        std::swap(to[at[b]],to[at[d]]);
+        at[d]++;
+      }
+    nodes[n].n = nodes[n].cap = start[1];
+    for (int k = 0 ; k < 4 ; k++){
+      node& c = nodes[nodes[n].child[k]];
+      c.first = first + start[k+1];
+      c.n = c.cap = start[k+2] - start[k+1];
+    }
+    for (int k = 0 ; k < 4 ; k++){
+      int c = nodes[n].child[k];
+      if (nodes[c].n > quad_node_max && nodes[c].size > quad_min_size)
+        split(c);
+    }
+  }
+
+  void insert(const T& t){
+    box b = bounds(t);
+    if (root < 0) root = add_node(0,0,quad_root_size);
+    while (!fits(nodes[root],b) && nodes[root].size < quad_max_size)
+      grow(b);
+    int n = root, q;
+    while (nodes[n].child[0] >= 0 && (q = quarter(nodes[n],b)) >= 0)
+      n = nodes[n].child[q];
+    node& d = nodes[n];
+    if (d.n == d.cap){
+      if (items.size() > 2*(size_t)count + 4*quad_node_max){
+        rebuild();
+        insert(t);
+        return;
+      }
+      int cap = std::max(4,d.cap*2), first = (int)items.size();
+      items.resize(first + cap);
+      for (int k = 0 ; k < d.n ; k++)
+        items[first+k] = std::move(items[d.first+k]);
+      d.first = first;
+      d.cap = cap;
+    }
+    items[d.first + d.n++] = t;
+    count++;
+    if (d.child[0] < 0 && d.n > quad_node_max && d.size > quad_min_size)
+      split(n);
+  }
+
+  void rebuild(){
+    std::vector<T> v;
+    v.reserve(count);
+    all([&](T& t){ v.push_back(std::move(t)); });
+    clear();
+    insert_all(v);
+  }
+
+  // like each, f returning true drops the item
+  template<class F>
+  int erase_if(const box& q,F f){
+    if (root < 0) return 0;
+    int erased = 0;
+    int stack[128], top = 0;
+    stack[top++] = root;
+    while (top){
+      node& n = nodes[stack[--top]];
+      T* s = items.data() + n.first;
+      for (int k = n.n-1 ; k >= 0 ; k--)
+        if (bounds(s[k]).overlaps(q) && f(s[k])){
+          s[k] = std::move(s[--n.n]);
+          erased++;
+        }
+      if (n.child[0] >= 0)
+        for (int k = 0 ; k < 4 ; k++)
+          if (area(nodes[n.child[k]]).overlaps(q))
+            stack[top++] = n.child[k];
+    }
+    count -= erased;
+    return erased;
+  }
+
+  // builds the tree top down when it is empty, much quicker than one insert at a time.
+  // the items are taken over as they are, so a vector reserved for them is the only allocation
+  void insert_all(std::vector<T>& v){
+    if (root >= 0 || v.empty()){
+      for (T& t : v)
+        insert(t);
+      return;
+    }
+    box b = bounds(v[0]);
+    for (T& t : v){
+      box c = bounds(t);
+      b = box{min(b.x0,c.x0),min(b.y0,c.y0),max(b.x1,c.x1),max(b.y1,c.y1)};
+    }
+    nodes.reserve(v.size()/quad_node_max*2 + 16);
+    root = add_node(0,0,quad_root_size);
+    while (!fits(nodes[root],b) && nodes[root].size < quad_max_size)
+      grow(b);
+    // split only goes one level down from a node, the levels grow made are empty
+    int n = root, q;
+    while (nodes[n].child[0] >= 0 && (q = quarter(nodes[n],b)) >= 0)
+      n = nodes[n].child[q];
+    items.swap(v);
+    count = (int)items.size();
+
+    // every item's node is found a level at a time before anything moves, -1-node once
+    // it can't go further down
+    std::vector<int> in(count,n), sizes;
+    for (bool split = true ; split ; ){
+      split = false;
+      sizes.assign(nodes.size(),0);
+      for (int m : in)
+        sizes[m < 0 ? -1-m : m]++;
+      for (int m = 0 , last = (int)nodes.size() ; m < last ; m++)
+        if (nodes[m].child[0] < 0 && sizes[m] > quad_node_max && nodes[m].size > quad_min_size){
+          divide(m);
+          split = true;
+        }
+      for (int k = 0 ; k < count && split ; k++){
+        int m = in[k], q;
+        if (m < 0 || nodes[m].child[0] < 0) continue;
+        q = quarter(nodes[m],bounds(items[k]));
+        in[k] = q < 0 ? -1-m : nodes[m].child[q];
+      }
+    }
+    // then they are swapped straight to their place in their node's slice
+    for (int m = 0 , first = 0 ; m < (int)nodes.size() ; m++){
+      nodes[m].first = first;
+      first += nodes[m].n = nodes[m].cap = sizes[m];
+      sizes[m] = nodes[m].first;
+    }
+    for (int& m : in)
+      m = sizes[m < 0 ? -1-m : m]++;
+    for (int k = 0 ; k < count ; k++)
+      while (in[k] != k){
+        std::swap(items[k],items[in[k]]);
+        std::swap(in[k],in[in[k]]);
+      }
+  }
+
+  // calls f on every item whose box overlaps q
+  template<class F>
+  void each(const box& q,F f){
+    if (root < 0) return;
+    int stack[128], top = 0;
+    stack[top++] = root;
+    while (top){
+      node& n = nodes[stack[--top]];
+      T* s = items.data() + n.first;
+      for (int k = 0 ; k < n.n ; k++)
+        if (bounds(s[k]).overlaps(q))
+          f(s[k]);
+      if (n.child[0] >= 0)
+        for (int k = 0 ; k < 4 ; k++)
+          if (area(nodes[n.child[k]]).overlaps(q))
+            stack[top++] = n.child[k];
+    }
+  }
+
+  template<class F>
+  void all(F f){
+    for (node& n : nodes)
+      for (int k = 0 ; k < n.n ; k++)
+        f(items[n.first+k]);
+  }
+
+  size_t bytes(){
+    return nodes.capacity()*sizeof(node) + items.capacity()*sizeof(T) + to.capacity();
+  }
+};
+
+// one decoded page. grid shows one and keeps recent ones and the ones next to it ready, turning the page swaps them
+struct page{
+  std::string file;
+  int number = -1;
+  quadtree<stroke> strokes;
+  point_pool pts; // for strokes, erased ones leave a gap until the page is compacted
+  quadtree<file_link> links;
+  unsigned int next_id = 1, saved_id = 1;
+  int journal_len = 0, journal_size = 0;
+
+  void insert(const stroke& st){
+    strokes.insert(st);
+  }
+
+  file_link insert_link(int x,int y,const std::string& file,int w){
+    file_link l{x,y,w,file};
+    links.insert(l);
+    return l;
+  }
+
+  // roughly what it holds on the heap, for the cache budget
+  size_t bytes(){
+    size_t b = sizeof(page) + strokes.bytes() + pts.bytes() + links.bytes();
+    links.all([&](file_link& l){ b += l.file.capacity(); });
+    return b;
+  }
+};
 
 
 void error_msg(framebuffer::FB* fb, std::string t){
@@ -80,53 +852,59 @@ void error_msg(framebuffer::FB* fb, std::string t){
 }
 
 
-void sql_bind_v(sqlite3_stmt* stmt, const char* args, va_list varg) {
+// false if a value couldn't be bound, too big for one. the statement keeps what it had there before
+bool sql_bind_v(sqlite3_stmt* stmt, const char* args, va_list varg) {
   sqlite3_reset(stmt);
+  int r = SQLITE_OK;
+  bool ok = true;
   if (args)
-    for (int i = 0 ; args[i]; i++) 
+    for (int i = 0 ; args[i]; i++){
       switch (args[i]) {
         case 'I':
-          sqlite3_bind_int64(stmt,i+1,va_arg(varg,sqlite3_int64));
+          r = sqlite3_bind_int64(stmt,i+1,va_arg(varg,sqlite3_int64));
           break;
         case 'i':
-          sqlite3_bind_int(stmt,i+1,va_arg(varg,int));
+          r = sqlite3_bind_int(stmt,i+1,va_arg(varg,int));
           break;
         case 'S': {
           int s = va_arg(varg,int);
-          sqlite3_bind_text(stmt,i+1,va_arg(varg,const char*),s,SQLITE_TRANSIENT);
+          r = sqlite3_bind_text(stmt,i+1,va_arg(varg,const char*),s,SQLITE_TRANSIENT);
           break;
         }
         case 's':
-          sqlite3_bind_text(stmt,i+1,va_arg(varg,const char*),-1,SQLITE_TRANSIENT);
+          r = sqlite3_bind_text(stmt,i+1,va_arg(varg,const char*),-1,SQLITE_TRANSIENT);
           break;
         case 'b': {
           int s = va_arg(varg,int);
-          sqlite3_bind_blob(stmt,i+1,va_arg(varg,const void*),s,SQLITE_TRANSIENT);
+          r = sqlite3_bind_blob(stmt,i+1,va_arg(varg,const void*),s,SQLITE_TRANSIENT);
           break;
         }
           
         case 'B': {
           sqlite3_uint64 s = va_arg(varg,sqlite3_uint64);
-          sqlite3_bind_blob64(stmt,i+1,va_arg(varg,const void*),s,SQLITE_TRANSIENT);
+          r = sqlite3_bind_blob64(stmt,i+1,va_arg(varg,const void*),s,SQLITE_TRANSIENT);
           break;
         }
         case 'D':
         case 'd':
         case 'F':
         case 'f':
-          sqlite3_bind_double(stmt,i+1,va_arg(varg,double));
+          r = sqlite3_bind_double(stmt,i+1,va_arg(varg,double));
           break;
         case 'N':
         case 'n':
-          sqlite3_bind_null(stmt,i+1);
+          r = sqlite3_bind_null(stmt,i+1);
           break;
         case 'Z':
-          sqlite3_bind_zeroblob64(stmt,i+1,va_arg(varg,sqlite3_uint64));
+          r = sqlite3_bind_zeroblob64(stmt,i+1,va_arg(varg,sqlite3_uint64));
           break;
         case 'z':
-          sqlite3_bind_zeroblob(stmt,i+1,va_arg(varg,int));
+          r = sqlite3_bind_zeroblob(stmt,i+1,va_arg(varg,int));
           break;
       }
+      ok = r == SQLITE_OK && ok;
+    }
+  return ok;
 }
 
 void sql_bind(sqlite3_stmt* stmt, const char* args, ...) {
@@ -137,45 +915,723 @@ void sql_bind(sqlite3_stmt* stmt, const char* args, ...) {
 }
 
 
-void sql_run(sqlite3_stmt* stmt, const char* args, ...) {
+bool sql_exec(sqlite3* db, const char* sql) {
+  return sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+}
+
+// the first column of the first row, 0 if there is none
+sqlite3_int64 sql_int(sqlite3_stmt* stmt, const char* args, ...) {
   va_list varg;
   va_start(varg,args);
   sql_bind_v(stmt,args,varg);
   va_end(varg);
-  while (sqlite3_step(stmt) != SQLITE_DONE){}//TODO error handling
+  sqlite3_int64 r = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt,0) : 0;
+  sqlite3_reset(stmt);
+  return r;
+}
+
+
+// false if it failed. that only undoes the statement, the transaction around it still commits
+// unless whoever ran it rolls back
+bool sql_run(sqlite3_stmt* stmt, const char* args, ...) {
+  va_list varg;
+  va_start(varg,args);
+  bool bound = sql_bind_v(stmt,args,varg);
+  va_end(varg);
+  if (!bound) return false;
+  int r;
+  while ((r = sqlite3_step(stmt)) == SQLITE_ROW){}
+  return r == SQLITE_DONE;
 }
 
 
+// turns document names and page numbers into ids on one connection. page numbers are
+// positions: the nth page of a document ordered by ord. pages past the end are blank and
+// only get rows once they are needed
+struct page_list{
+  sqlite3* db = nullptr;
+  sqlite3_stmt* find_p, *nth_p, *last_p, *add_p, *set_p, *renumber_p, *find_d, *add_d, *back_p;
+  std::unordered_map<std::string,int> docs;
+  bool ok = true; // false once a write failed, whoever started the transaction rolls it back and calls forget
+
+  bool open(sqlite3* db){
+    this->db = db;
+    docs.clear();
+    return !(sqlite3_prepare_v2(db,find_page_str,-1,&find_p,NULL)
+      || sqlite3_prepare_v2(db,nth_page_str,-1,&nth_p,NULL)
+      || sqlite3_prepare_v2(db,last_page_str,-1,&last_p,NULL)
+      || sqlite3_prepare_v2(db,add_page_str,-1,&add_p,NULL)
+      || sqlite3_prepare_v2(db,set_page_str,-1,&set_p,NULL)
+      || sqlite3_prepare_v2(db,renumber_pages_str,-1,&renumber_p,NULL)
+      || sqlite3_prepare_v2(db,find_doc_str,-1,&find_d,NULL)
+      || sqlite3_prepare_v2(db,add_doc_str,-1,&add_d,NULL)
+      || sqlite3_prepare_v2(db,backlinks_str,-1,&back_p,NULL));
+  }
+
+  void close(){
+    sqlite3_finalize(find_p);
+    sqlite3_finalize(nth_p);
+    sqlite3_finalize(last_p);
+    sqlite3_finalize(add_p);
+    sqlite3_finalize(set_p);
+    sqlite3_finalize(renumber_p);
+    sqlite3_finalize(find_d);
+    sqlite3_finalize(add_d);
+    sqlite3_finalize(back_p);
+    db = nullptr;
+  }
+
+  // ids of documents made in a transaction that was rolled back are gone again
+  void forget(){
+    docs.clear();
+    ok = true;
+  }
+
+  int doc_id(const std::string& name){
+    auto it = docs.find(name);
+    if (it != docs.end()) return it->second;
+    ok = sql_run(add_d,"s",name.c_str()) && ok;
+    return docs[name] = (int)sql_int(find_d,"s",name.c_str());
+  }
+
+  // id and order key of the nth page, false past the end
+  bool nth(int doc,int n,int& id,sqlite3_int64& ord){
+    sql_bind(nth_p,"ii",doc,n);
+    bool found = sqlite3_step(nth_p) == SQLITE_ROW;
+    if (found){
+      id = sqlite3_column_int(nth_p,0);
+      ord = sqlite3_column_int64(nth_p,1);
+    }
+    sqlite3_reset(nth_p);
+    return found;
+  }
+
+  // gives the document at least n pages, returns the key to append after them
+  sqlite3_int64 pad(int doc,int n){
+    sql_bind(last_p,"i",doc);
+    int count = 0;
+    sqlite3_int64 ord = -page_gap;
+    if (sqlite3_step(last_p) == SQLITE_ROW){
+      count = sqlite3_column_int(last_p,0);
+      if (count) ord = sqlite3_column_int64(last_p,1);
+    }
+    sqlite3_reset(last_p);
+    for (; count < n ; count++)
+      ok = sql_run(add_p,"iI",doc,ord += page_gap) && ok;
+    return ord + page_gap;
+  }
+
+  // 0 if the page has no row and create is false
+  int page_id(const std::string& file,int page,bool create){
+    if (!create) return (int)sql_int(find_p,"si",file.c_str(),page);
+    int doc = doc_id(file), id;
+    sqlite3_int64 ord;
+    if (nth(doc,page,id,ord)) return id;
+    ok = sql_run(add_p,"iI",doc,pad(doc,page)) && ok;
+    return ok ? (int)sqlite3_last_insert_rowid(db) : 0;
+  }
+
+  // key that puts a page at position n, in front of the page there now
+  sqlite3_int64 ord_at(int doc,int n){
+    int id;
+    sqlite3_int64 prev, next;
+    if (!nth(doc,n,id,next)) return pad(doc,n);
+    if (n == 0) return next - page_gap;
+    nth(doc,n-1,id,prev);
+    if (next - prev < 2){
+      ok = sql_run(renumber_p,"iI",doc,page_gap) && ok;
+      nth(doc,n-1,id,prev);
+      nth(doc,n,id,next);
+    }
+    return prev + (next - prev)/2;
+  }
+
+  // every page that links to file as document and page number, sorted by both. what
+  // hasn't been written yet isn't in it, see grid::linked_from
+  void linked_from(const std::string& file,std::vector<std::pair<std::string,int>>& out){
+    sql_bind(back_p,"s",file.c_str());
+    while (sqlite3_step(back_p) == SQLITE_ROW)
+      out.emplace_back((const char*)sqlite3_column_text(back_p,0),sqlite3_column_int(back_p,1));
+    sqlite3_reset(back_p);
+  }
+
+  // moves one page row whatever the size of either document, a blank page is made if there is none to move.
+  // it goes in front of the page at to_page and the number it ends up with is returned, one less than
+  // to_page when it moved down its own document
+  int move(const std::string& from,int from_page,const std::string& to,int to_page){
+    int f = doc_id(from), t = doc_id(to), id;
+    sqlite3_int64 ord = ord_at(t,to_page), old;
+    if (nth(f,from_page,id,old)){
+      ok = sql_run(set_p,"iIi",t,ord,id) && ok;
+      return f == t && from_page < to_page ? to_page-1 : to_page;
+    }
+    ok = sql_run(add_p,"iI",t,ord) && ok;
+    return to_page;
+  }
+};
+
+// decodes a page from one connection, the ui reads the page it has to show and the
+// writer thread reads the ones next to it ahead of time
+struct page_reader{
+  sqlite3_stmt* read_s, *read_l, *read_j;
+
+  bool open(sqlite3* db){
+    return !(sqlite3_prepare_v2(db,read_st_str,-1,&read_s,NULL)
+      || sqlite3_prepare_v2(db,read_link_str,-1,&read_l,NULL)
+      || sqlite3_prepare_v2(db,read_journal_str,-1,&read_j,NULL));
+  }
+
+  void close(){
+    sqlite3_finalize(read_s);
+    sqlite3_finalize(read_l);
+    sqlite3_finalize(read_j);
+  }
+
+  // p should be empty, id 0 leaves it blank
+  void read(page& p,int id){
+    // the journal is read first so erased strokes are known before the page is decoded.
+    // tombstones written before strokes were polylines name segments, those have to go
+    // before the segments are joined and the rest after
+    std::vector<stroke> journal, strokes, segs;
+    std::unordered_set<unsigned int> dead, dead_segs;
+    std::vector<std::vector<stroke>> old;
+    point_pool seg_pts;
+    stroke st;
+    sql_bind(read_j,"i",id);
+    int t = 0;
+    while ((t=sqlite3_step(read_j)) != SQLITE_DONE){
+      if (t == SQLITE_ROW) {
+        int size = sqlite3_column_bytes(read_j,0);
+        stroke_unpacker up(sqlite3_column_blob(read_j,0),size);
+        if (up.segments()) old.emplace_back();
+        while (up.next(st,up.segments() ? seg_pts : p.pts))
+          (up.segments() ? old.back() : journal).push_back(st);
+        unsigned int n, k, pid = 0;
+        if (up.get(n))
+          while (n-- && up.get(k))
+            (up.segments() ? dead_segs : dead).insert(pid += unzigzag(k));
+        if (up.next_id > p.next_id) p.next_id = up.next_id;
+        p.journal_len++;
+      }
+    }
+    int journaled = (int)journal.size();
+    for (auto& v : old){
+      journaled += (int)v.size();
+      join_segments(v,seg_pts,dead_segs,journal,p.pts);
+    }
+
+    sql_bind(read_s,"i",id);
+    while ((t=sqlite3_step(read_s)) != SQLITE_DONE){
+      if (t == SQLITE_ROW) {
+        int size = sqlite3_column_bytes(read_s,0);
+        stroke_unpacker up(sqlite3_column_blob(read_s,0),size);
+        // the page is allocated once from what the blob says it holds, a point takes at
+        // least two bytes. strokes becomes the quadtree's storage
+        strokes.reserve(strokes.size() + up.count + journal.size());
+        p.pts.reserve(p.pts.size() + (up.segments() ? up.count*2 : size/2));
+        if (up.segments()){
+          segs.reserve(up.count);
+          while (up.next(st,seg_pts))
+            segs.push_back(st);
+          join_segments(segs,seg_pts,dead_segs,strokes,p.pts);
+          segs.clear();
+        }
+        while (up.next(st,p.pts))
+          strokes.push_back(st);
+        if (up.next_id > p.next_id) p.next_id = up.next_id;
+      }
+
+    }
+    if (!dead.empty())
+      strokes.erase(std::remove_if(strokes.begin(),strokes.end(),[&](const stroke& k){ return dead.count(k.id) > 0; }),strokes.end());
+    for (stroke& k : journal)
+      if (!dead.count(k.id))
+        strokes.push_back(std::move(k));
+    p.strokes.insert_all(strokes);
+    p.journal_size = (int)(journaled + dead.size() + dead_segs.size());
+    p.saved_id = p.next_id;
+
+
+    sql_bind(read_l,"i",id);
+    t = 0;
+    while ((t=sqlite3_step(read_l)) != SQLITE_DONE){
+      if (t == SQLITE_BUSY) continue;
+      if (t == SQLITE_ROW) {
+        const unsigned char* s = sqlite3_column_text(read_l,0);
+        std::string t((const char*)s);
+        p.insert_link(sqlite3_column_int(read_l,1),sqlite3_column_int(read_l,2),t,sqlite3_column_int(read_l,3));
+        continue;
+      }
+    }
+  }
+};
+
+
+// what grid::save hands to the writer thread, a copy so the page can keep changing
+struct page_edit{
+  std::string file;
+  int page;
+  unsigned int next_id;
+  bool compact = false; // added is every stroke on the page and replaces it and its journal
+  std::vector<stroke> added;
+  point_pool pts; // added's own copy, the page's keeps changing on the ui thread
+  std::vector<unsigned int> erased;
+  std::vector<file_link> links_added, links_removed;
+};
+
+// one step of undo: the strokes and links that went from a page and the ones that came, or a
+// page that moved from file,page to to,to_page. strokes that went keep their points here, the
+// ones that came are only looked up again by id and box
+struct page_op{
+  std::string file;
+  int page;
+  std::vector<stroke> gone, came;
+  point_pool pts; // gone's points
+  std::vector<file_link> links_gone, links_came;
+  bool moved = false;
+  std::string to;
+  int to_page;
+
+  bool empty() const {
+    return !moved && gone.empty() && came.empty() && links_gone.empty() && links_came.empty();
+  }
+  size_t bytes() const {
+    return sizeof(page_op) + pts.bytes() + (gone.capacity()+came.capacity())*sizeof(stroke)
+      + (links_gone.capacity()+links_came.capacity())*sizeof(file_link);
+  }
+};
+
+// commits page edits on its own thread and connection so turning a page only pays for reading the next one.
+// whatever queued up while the last commit ran goes into the next one together.
+// in between it decodes the pages next to the one on screen so turning to them costs nothing
+struct page_writer{
+  std::thread th;
+  std::mutex m;
+  std::condition_variable wake, idle;
+  std::deque<page_edit> queue, batch;
+  std::deque<page_edit> failed; // a batch that was rolled back, it goes again in front of the next one
+  std::string error; // why, until the ui has shown it. see failure
+  std::deque<page> reads, ready;
+  bool busy = false, quit = false;
+  int ckpt = -1; // a requested SQLITE_CHECKPOINT_* mode
+  int gen = 0; // bumped when pages move, reads started before that are thrown away
+  int maint = -1; // next maintenance step, -1 when none is asked for
+  bool maint_full = false;
+  int held = 0; // maintenance waits while the ui has the database, see hold
+  sqlite3_int64 reclaimed = 0; // bytes the current pass has given back
+
+  sqlite3* db = nullptr;
+  sqlite3_stmt* write_s, *clear_s, *write_j, *clear_j, *write_l, *remove_l;
+  page_list pages;
+  page_reader reader;
+
+  bool start(){
+    if (db) return true;
+    if (sqlite3_open(db_path,&db) != SQLITE_OK
+      || !pages.open(db)
+      || !reader.open(db)
+      || sqlite3_prepare_v2(db,write_st_str,-1,&write_s,NULL)
+      || sqlite3_prepare_v2(db,clear_st_str,-1,&clear_s,NULL)
+      || sqlite3_prepare_v2(db,write_journal_str,-1,&write_j,NULL)
+      || sqlite3_prepare_v2(db,clear_journal_str,-1,&clear_j,NULL)
+      || sqlite3_prepare_v2(db,write_link_str,-1,&write_l,NULL)
+      || sqlite3_prepare_v2(db,remove_link_str,-1,&remove_l,NULL)){
+      sqlite3_close_v2(db);
+      db = nullptr;
+      return false;
+    }
+    sqlite3_busy_timeout(db,busy_timeout);
+    sql_exec(db,connection_str);
+    quit = false;
+    ckpt = -1;
+    maint = -1;
+    maint_full = false;
+    held = 0;
+    reclaimed = 0;
+    th = std::thread([this]{ run(); });
+    return true;
+  }
+
+  // writes out whatever is still queued first
+  void stop(){
+    if (!db) return;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      quit = true;
+    }
+    wake.notify_one();
+    th.join();
+    reads.clear();
+    ready.clear();
+    error.clear();
+    pages.close();
+    reader.close();
+    sqlite3_finalize(write_s);
+    sqlite3_finalize(clear_s);
+    sqlite3_finalize(write_j);
+    sqlite3_finalize(clear_j);
+    sqlite3_finalize(write_l);
+    sqlite3_finalize(remove_l);
+    sqlite3_close(db);
+    db = nullptr;
+  }
+
+  void push(page_edit&& e){
+    {
+      std::lock_guard<std::mutex> lock(m);
+      queue.push_back(std::move(e));
+    }
+    wake.notify_one();
+  }
+
+  // copies the log into notes.db once the queue is empty, truncate also empties the log file
+  void checkpoint(bool truncate = false){
+    {
+      std::lock_guard<std::mutex> lock(m);
+      int mode = truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE;
+      if (mode > ckpt) ckpt = mode;
+    }
+    wake.notify_one();
+  }
+
+  // returns once everything pushed so far is committed
+  void flush(){
+    hold();
+    release();
+  }
+
+  // flushes and keeps maintenance from writing until release, for the ui to write to the
+  // database itself. a commit from here between its reads and its writes would leave it
+  // stuck on a snapshot it can't write from
+  void hold(){
+    std::unique_lock<std::mutex> lock(m);
+    held++;
+    idle.wait(lock,[this]{ return queue.empty() && ckpt < 0 && !busy; });
+  }
+  void release(){
+    {
+      std::lock_guard<std::mutex> lock(m);
+      held--;
+    }
+    wake.notify_one();
+  }
+
+  // p has its file, number and row size set. it is read once the edits pushed before it are written
+  void prefetch(page&& p){
+    {
+      std::lock_guard<std::mutex> lock(m);
+      reads.push_back(std::move(p));
+    }
+    wake.notify_one();
+  }
+
+  // the pages read since the last call
+  void fetched(std::vector<page>& out){
+    std::lock_guard<std::mutex> lock(m);
+    for (page& p : ready)
+      out.push_back(std::move(p));
+    ready.clear();
+  }
+
+  void drop_reads(){
+    std::lock_guard<std::mutex> lock(m);
+    reads.clear();
+    ready.clear();
+    gen++;
+  }
+
+  // full also checks every table, for when nothing is going to happen for a while
+  void maintain(bool full = false){
+    {
+      std::lock_guard<std::mutex> lock(m);
+      if (maint < 0) maint = 0;
+      maint_full |= full;
+    }
+    wake.notify_one();
+  }
+
+  bool maintaining(){
+    std::lock_guard<std::mutex> lock(m);
+    return maint >= 0;
+  }
+
+  bool pending(const std::string& file,int page){
+    std::lock_guard<std::mutex> lock(m);
+    for (page_edit& e : batch)
+      if (e.page == page && e.file == file) return true;
+    for (page_edit& e : queue)
+      if (e.page == page && e.file == file) return true;
+    return false;
+  }
+
+  void run(){
+    std::unique_lock<std::mutex> lock(m);
+    while (true){
+      wake.wait(lock,[this]{ return quit || !queue.empty() || ckpt >= 0 || !reads.empty() || (maint >= 0 && !held); });
+      // what failed gets one last go on the way out
+      if (!queue.empty() || (quit && !failed.empty())){
+        busy = true;
+        batch.swap(failed);
+        for (page_edit& e : queue)
+          batch.push_back(std::move(e));
+        queue.clear();
+        lock.unlock();
+        bool ok = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) == SQLITE_OK;
+        for (size_t i = 0 ; i < batch.size() && ok ; i++)
+          ok = write(batch[i]);
+        if (ok)
+          ok = sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL) == SQLITE_OK;
+        std::string why;
+        if (!ok){
+          why = "saving " + std::to_string(batch.size()) + " pages failed: " + sqlite3_errmsg(db);
+          std::cerr << why << "\n";
+          sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+          pages.forget();
+        }
+        lock.lock();
+        if (!ok && !quit){
+          failed.swap(batch);
+          error = why;
+        }
+        batch.clear();
+      } else if (!reads.empty() && !quit){
+        page p = std::move(reads.front());
+        reads.pop_front();
+        int g = gen;
+        lock.unlock();
+        reader.read(p,pages.page_id(p.file,p.number,false));
+        lock.lock();
+        if (g == gen)
+          ready.push_back(std::move(p));
+      } else if (ckpt >= 0){
+        busy = true;
+        int mode = ckpt;
+        ckpt = -1;
+        lock.unlock();
+        int log = 0, done = 0;
+        if (sqlite3_wal_checkpoint_v2(db,NULL,mode,&log,&done) != SQLITE_OK)
+          std::cerr << "checkpoint failed: " << sqlite3_errmsg(db) << "\n";
+        lock.lock();
+      } else if (maint >= 0 && !held && !quit){
+        busy = true;
+        int step = maint;
+        bool full = maint_full;
+        lock.unlock();
+        sqlite3_progress_handler(db,1000,[](void* w){ return (int)((page_writer*)w)->waiting(); },this);
+        step = maintain_step(step,full);
+        sqlite3_progress_handler(db,0,NULL,NULL);
+        lock.lock();
+        maint = step;
+        // a full pass asked for after this one had skipped the checks starts over
+        if (maint < 0 && maint_full && !full) maint = 0;
+        else if (maint < 0) maint_full = false;
+      } else {
+        busy = false;
+        break;
+      }
+      busy = false;
+      idle.notify_all();
+    }
+  }
+
+  // true once a batch has failed to commit, with why. its edits are tried again with the next one
+  bool failure(std::string& why){
+    std::lock_guard<std::mutex> lock(m);
+    if (error.empty()) return false;
+    why.swap(error);
+    error.clear();
+    return true;
+  }
+
+  // anything maintenance should get out of the way of
+  bool waiting(){
+    std::lock_guard<std::mutex> lock(m);
+    return quit || held || !queue.empty() || !reads.empty() || ckpt >= 0;
+  }
+
+  void db_stats(sqlite3_int64& pages,sqlite3_int64& free,sqlite3_int64& page_size){
+    sqlite3_stmt* stmt;
+    pages = free = page_size = 0;
+    if (sqlite3_prepare_v2(db,db_stats_str,-1,&stmt,NULL)) return;
+    if (sqlite3_step(stmt) == SQLITE_ROW){
+      pages = sqlite3_column_int64(stmt,0);
+      free = sqlite3_column_int64(stmt,1);
+      page_size = sqlite3_column_int64(stmt,2);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  // runs one step and returns the one to run next, the same one again if it was interrupted
+  // and -1 once the pass is done. 0 gives free pages back until there are none, 1 refreshes
+  // the planner's statistics and 2 on check one table each
+  int maintain_step(int step,bool full){
+    sqlite3_int64 pages, free, page_size;
+    if (step == 0){
+      db_stats(pages,free,page_size);
+      if (!free) return 1;
+      int r = sqlite3_exec(db,vacuum_step_str,NULL,NULL,NULL);
+      if (r == SQLITE_INTERRUPT) return 0;
+      sqlite3_int64 left;
+      db_stats(pages,left,page_size);
+      reclaimed += (free-left)*page_size;
+      // a database that isn't incremental yet never shrinks
+      return r == SQLITE_OK && left < free ? 0 : 1;
+    }
+    if (step == 1){
+      if (sqlite3_exec(db,optimize_str,NULL,NULL,NULL) == SQLITE_INTERRUPT) return 1;
+      return full ? 2 : 2+num_checked_tables;
+    }
+    if (step < 2+num_checked_tables){
+      const char* table = checked_tables[step-2];
+      std::string sql = std::string("PRAGMA integrity_check(") + table + ");";
+      sqlite3_stmt* stmt;
+      if (sqlite3_prepare_v2(db,sql.c_str(),-1,&stmt,NULL)) return step+1;
+      int r;
+      while ((r = sqlite3_step(stmt)) == SQLITE_ROW){
+        const char* msg = (const char*)sqlite3_column_text(stmt,0);
+        if (msg && strcmp(msg,"ok"))
+          std::cerr << "notes.db " << table << ": " << msg << "\n";
+      }
+      sqlite3_finalize(stmt);
+      return r == SQLITE_INTERRUPT ? step : step+1;
+    }
+
+    db_stats(pages,free,page_size);
+    if (full || reclaimed > 0)
+      std::cerr << "notes.db: " << pages*page_size/1024 << "k, " << free << " of " << pages << " pages free ("
+        << (pages ? free*100/pages : 0) << "%), reclaimed " << reclaimed/1024 << "k\n";
+    // the freed pages only leave the file once the log is copied back
+    if (reclaimed > 0)
+      sqlite3_wal_checkpoint_v2(db,NULL,SQLITE_CHECKPOINT_PASSIVE,NULL,NULL);
+    reclaimed = 0;
+    return -1;
+  }
+
+  // false if any of it failed, the batch is rolled back then
+  bool write(page_edit& e){
+    int page = pages.page_id(e.file,e.page,true);
+    bool ok = page != 0;
+    if (ok && (e.compact || !e.added.empty() || !e.erased.empty())){
+      stroke_packer pk;
+      pk.begin(e.added.size(),e.next_id);
+      for (stroke& k : e.added)
+        pk.add(k,e.pts);
+
+      if (e.compact){
+        ok = sql_run(clear_s,"i",page) && sql_run(clear_j,"i",page);
+        if (ok && !e.added.empty())
+          ok = sql_run(write_s,"ib",page,(int)pk.data.size(),pk.data.data());
+      } else {
+        // a journal entry is the added strokes packed like a page followed by the erased ids
+        pk.put(e.erased.size());
+        unsigned int pid = 0;
+        for (unsigned int id : e.erased){
+          pk.put(zigzag((int)(id-pid)));
+          pid = id;
+        }
+        ok = sql_run(write_j,"ib",page,(int)pk.data.size(),pk.data.data());
+      }
+    }
+    for (size_t i = 0 ; i < e.links_removed.size() && ok ; i++){
+      file_link& l = e.links_removed[i];
+      ok = sql_run(remove_l,"iiii",page,pages.doc_id(l.file),l.x,l.y);
+    }
+    for (size_t i = 0 ; i < e.links_added.size() && ok ; i++){
+      file_link& l = e.links_added[i];
+      ok = sql_run(write_l,"iiiii",page,pages.doc_id(l.file),l.x,l.y,l.w);
+    }
+    return ok && pages.ok;
+  }
+};
+
+
 struct grid{
-  int row_h;
-  int row_w;
   int h;
   int y,y_scroll;
-  std::vector<grid_row> rows;
-  bool loaded = false, edited = false, linksedited = false;
+  page cur;
+  std::vector<page> cache; // decoded pages other than cur, least recently shown first. see load
+  size_t cache_budget = page_cache_bytes;
+  int cache_hits = 0, cache_misses = 0;
+  std::vector<std::pair<std::string,int>> reading; // asked of the writer and not back yet
+  bool loaded = false;
   std::string current_file = "Home";
   int current_page = 0;
+
+  // everything done to the page since the last save, save() only writes these
+  std::vector<stroke> added;
+  std::vector<unsigned int> erased;
+  std::vector<file_link> links_added, links_removed;
+  std::unordered_map<std::string,int> link_widths; // by name, for links made since opening
+  // the select tool's strokes and the box around them as drawn
+  std::unordered_set<unsigned int> selected;
+  box sel_box = stroke().bb;
+  // undo and redo steps, oldest first. op is what has been done since the pen went down, it
+  // is one step once the pen lifts. the oldest steps go once undo_log is over undo_budget
+  std::deque<page_op> undo_log, redo_log;
+  page_op op;
+  size_t undo_budget = undo_log_bytes;
+  // the line under the pen, it joins the page when the pen lifts
+  stroke pen;
+  point_pool pen_pts;
+  bool drawing = false;
+
   framebuffer::FB* fb;
   sqlite3* db = nullptr;
-  sqlite3_stmt* read_s, *write_s, *clear_s;
-  sqlite3_stmt* read_l, *write_l, *clear_l;
-  
-  sqlite3_stmt* shift_s, *page_s, *shift_l, *page_l;
+  page_writer writer;
+  page_reader reader;
+  page_list pages;
+  bool shrink = false;
+  bool upgraded = false; // since the tables were last checked
+  int sleeps = 0; // the same
 
   void move(std::string from, int from_page, std::string to, int to_page) {
-    sql_run(shift_s,"sii",to.c_str(),to_page,1);
-    sql_run(shift_l,"sii",to.c_str(),to_page,1);
-
-    sql_run(page_s,"sisi",from.c_str(),from_page,to.c_str(),to_page);
-    sql_run(page_l,"sisi",from.c_str(),from_page,to.c_str(),to_page);
+    commit();
+    op.to_page = move_page(from,from_page,to,to_page);
+    if (op.to_page < 0) return;
+    op.moved = true;
+    op.file = from;
+    op.page = from_page;
+    op.to = to;
+    push(undo_log);
+    redo_log.clear();
+  }
+  // returns the number the page ends up with, see page_list::move. -1 if it couldn't be moved
+  int move_page(const std::string& from, int from_page, const std::string& to, int to_page) {
+    // every decoded page may have a different number afterwards
+    unload();
+    writer.hold();
+    bool ok = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) == SQLITE_OK;
+    int at = ok ? pages.move(from,from_page,to,to_page) : -1;
+    if (!ok || !pages.ok || sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL) != SQLITE_OK){
+      std::string why = std::string("moving the page failed: ") + sqlite3_errmsg(db);
+      sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+      pages.forget();
+      error_msg(fb,why);
+      at = -1;
+    }
+    writer.release();
+    return at;
+  }
 
-    sql_run(shift_s,"sii",from.c_str(),from_page+1,-1);
-    sql_run(shift_l,"sii",from.c_str(),from_page+1,-1);
+  // pages that link to file, the links on this page are saved first so they are counted
+  std::vector<std::pair<std::string,int>> linked_from(const std::string& file){
+    std::vector<std::pair<std::string,int>> out;
+    if (!db) return out;
+    save();
+    writer.flush();
+    pages.linked_from(file,out);
+    return out;
   }
   
   void open(){
+    if (sleep_timer){
+      ui::cancel_timer(sleep_timer);
+      sleep_timer = nullptr;
+    }
     if (db) return;
-    sqlite3_open("/home/root/notes.db",&db);
+    sqlite3_open(db_path,&db);
+    sqlite3_busy_timeout(db,busy_timeout);
+    sql_exec(db,connection_str);
     char* err = nullptr;
     sqlite3_exec(db,init_st_str,NULL,NULL,&err);
     std::cout << err << "\n";
@@ -184,49 +1640,160 @@ struct grid{
       sqlite3_free(err);
     }
     
-    if (sqlite3_prepare_v2(db,read_st_str,-1,&read_s,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,read_link_str,-1,&read_l,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,write_st_str,-1,&write_s,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,write_link_str,-1,&write_l,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,clear_st_str,-1,&clear_s,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,clear_link_str,-1,&clear_l,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,shift_st_str,-1,&shift_s,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,shift_link_str,-1,&shift_l,NULL))
-      error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,setpage_st_str,-1,&page_s,NULL))
+    // migrations measure link text
+    stbtext::setup_font();
+    upgrade();
+    
+    if (!reader.open(db))
       error_msg(fb,(const char*)sqlite3_errmsg(db));
-    if (sqlite3_prepare_v2(db,setpage_link_str,-1,&page_l,NULL))
+    if (!pages.open(db))
       error_msg(fb,(const char*)sqlite3_errmsg(db));
+    if (!writer.start())
+      error_msg(fb,"can't open notes.db for writing");
     load(current_file,current_page);
   }
 
+  // takes the database from version-1 to version, schema changes get a new case at the end
+  bool migrate(int version){
+    switch (version){
+      case 1: return sql_exec(db,create_tables_str);
+      case 2: return migrate_pen_strokes();
+      case 3: return sql_exec(db,create_indexes_str);
+      case 4: shrink = true; return sql_exec(db,intern_documents_str);
+      case 5: return sql_exec(db,order_pages_str);
+      case 6: shrink = true; return sql_exec(db,auto_vacuum_str);
+      case 7: return measure_links();
+      case 8: return sql_exec(db,backlinks_index_str);
+    }
+    return false;
+  }
+
+  // each step runs in its own transaction, a failed one is rolled back and the rest are skipped
+  void upgrade(){
+    sqlite3_stmt* read, *write;
+    if (sqlite3_prepare_v2(db,read_version_str,-1,&read,NULL) || sqlite3_prepare_v2(db,write_version_str,-1,&write,NULL)){
+      error_msg(fb,(const char*)sqlite3_errmsg(db));
+      return;
+    }
+    int version = 0;
+    if (sqlite3_step(read) == SQLITE_ROW)
+      version = sqlite3_column_int(read,0);
+    sqlite3_finalize(read);
+
+    for (int v = version+1 ; v <= schema_version ; v++){
+      sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+      if (!migrate(v)){
+        error_msg(fb,"upgrading notes.db to version "+std::to_string(v)+" failed: "+sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        break;
+      }
+      sql_run(write,"i",v);
+      sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+      upgraded = true;
+    }
+    sqlite3_finalize(write);
+    // steps that drop whole tables hand the space back
+    if (shrink)
+      sql_exec(db,"VACUUM;");
+    shrink = false;
+  }
+
+  bool measure_links(){
+    if (!sql_exec(db,link_width_str))
+      return false;
+    sqlite3_stmt* stmt, *write;
+    if (sqlite3_prepare_v2(db,link_names_str,-1,&stmt,NULL))
+      return false;
+    if (sqlite3_prepare_v2(db,set_link_width_str,-1,&write,NULL)){
+      sqlite3_finalize(stmt);
+      return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      sql_run(write,"ii",link_width((const char*)sqlite3_column_text(stmt,1)),sqlite3_column_int(stmt,0));
+    sqlite3_finalize(stmt);
+    sqlite3_finalize(write);
+    return true;
+  }
+
+  bool migrate_pen_strokes(){
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db,has_pen_strokes_str,-1,&stmt,NULL))
+      return false;
+    bool old = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    if (!old) return true;
+
+    sqlite3_stmt* write;
+    if (sqlite3_prepare_v2(db,read_pen_strokes_str,-1,&stmt,NULL))
+      return false;
+    if (sqlite3_prepare_v2(db,pack_pen_strokes_str,-1,&write,NULL)){
+      sqlite3_finalize(stmt);
+      return false;
+    }
+
+    std::string file;
+    int page = -1;
+    std::vector<stroke> segs, strokes;
+    point_pool seg_pts, pts;
+    auto flush = [&](){
+      if (segs.empty()) return;
+      join_segments(segs,seg_pts,{},strokes,pts);
+      stroke_packer pk;
+      pk.begin(strokes.size(),segs.size()+1);
+      for (stroke& k : strokes)
+        pk.add(k,pts);
+      sql_run(write,"sib",file.c_str(),page,(int)pk.data.size(),pk.data.data());
+      segs.clear();
+      strokes.clear();
+      seg_pts.clear();
+      pts.clear();
+    };
+    while (sqlite3_step(stmt) == SQLITE_ROW){
+      const char* f = (const char*)sqlite3_column_text(stmt,0);
+      int p = sqlite3_column_int(stmt,1);
+      if (p != page || file != f){
+        flush();
+        file = f;
+        page = p;
+      }
+      stroke st;
+      st.begin(seg_pts,sqlite3_column_int(stmt,2),sqlite3_column_int(stmt,3));
+      if (!(st.last(seg_pts) == point{sqlite3_column_int(stmt,4),sqlite3_column_int(stmt,5)}))
+        st.add(seg_pts,sqlite3_column_int(stmt,4),sqlite3_column_int(stmt,5));
+      st.width = (char)sqlite3_column_int(stmt,6);
+      st.color = (char)sqlite3_column_int(stmt,7);
+      st.type = (char)sqlite3_column_int(stmt,8);
+      st.etc = (char)sqlite3_column_int(stmt,9);
+      st.id = (unsigned int)segs.size()+1;
+      segs.push_back(st);
+    }
+    flush();
+    sqlite3_finalize(stmt);
+    sqlite3_finalize(write);
+    return sql_exec(db,"drop table pen_strokes;");
+  }
+
   void close(){
     if (!db) return;
+    if (idle_timer){
+      ui::cancel_timer(idle_timer);
+      idle_timer = nullptr;
+    }
+    if (sleep_timer){
+      ui::cancel_timer(sleep_timer);
+      sleep_timer = nullptr;
+    }
     unload();
+    writer.stop();
+    std::cerr << "page cache: " << cache_hits << " hits, " << cache_misses << " misses\n";
     
-    sqlite3_finalize(read_s);
-    sqlite3_finalize(read_l);
-    sqlite3_finalize(write_s);
-    sqlite3_finalize(write_l);
-    sqlite3_finalize(clear_s);
-    sqlite3_finalize(page_s);
-    sqlite3_finalize(page_l);
-    sqlite3_finalize(shift_s);
-    sqlite3_finalize(shift_l);
+    reader.close();
+    pages.close();
     sqlite3_close(db);
     db = nullptr;
   }
   
-  void init(int w,int h,int y,framebuffer::FB* FB){
-    row_h = h/16+1;
-    row_w = w/16+1;
+  void init(int h,int y,framebuffer::FB* FB){
     y_scroll = 0;
     this->h = h;
     this->y = y;
@@ -235,85 +1802,185 @@ struct grid{
   }
   void save(){
     if (!db) return;
+    end_stroke();
+    commit();
     if (loaded){
-      if (edited){
-        sql_run(clear_s,"si",current_file.c_str(),current_page);
-        
-        sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
-        int s = (int)rows.size();
-        for (int j = 0 ; j < s ; j++)
-          for (int i = 0 ; i < 16 ; i++)
-            for (stroke& k : rows[j].vect[i])
-              sql_run(write_s,"siiiiiiiii",current_file.c_str(),current_page,k.ax,k.ay,k.bx,k.by,k.width,k.color,k.type,k.etc); 
-        sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
-        
-        edited = false;
-      }
-      
-      if (linksedited){
-        sql_run(clear_l,"si",current_file.c_str(),current_page);
-        
-        int s = (int)rows.size();
-        sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
-        for (int j = 0 ; j < s ; j++)
-          for (file_link& l : rows[j].links)
-            sql_run(write_l,"sisiii",current_file.c_str(),current_page,l.file.c_str(),0,l.x,l.y);
-        sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+      if (added.empty() && erased.empty() && links_added.empty() && links_removed.empty()) return;
+      page_edit e;
+      e.file = current_file;
+      e.page = current_page;
+      e.next_id = cur.next_id;
+
+      if (!added.empty() || !erased.empty()){
+        cur.journal_size += (int)(added.size() + erased.size());
+        if (++cur.journal_len > max_journal_len || cur.journal_size > cur.strokes.count/2){
+          e.compact = true;
+          // the page's points are packed again on the way, leaving out what was erased
+          size_t n = 0;
+          cur.strokes.all([&](stroke& st){ n += st.n; });
+          point_pool pts;
+          pts.reserve(n);
+          e.added.reserve(cur.strokes.count);
+          cur.strokes.all([&](stroke& st){
+            st.copy_to(cur.pts,pts);
+            e.added.push_back(st);
+          });
+          std::swap(cur.pts,pts);
+          e.pts = cur.pts;
+          // in the order they were drawn, so strokes near each other are next to each other in the blob
+          std::sort(e.added.begin(),e.added.end(),[](const stroke& a,const stroke& b){ return a.id < b.id; });
+          cur.journal_len = cur.journal_size = 0;
+        } else {
+          for (stroke& st : added)
+            st.copy_to(cur.pts,e.pts);
+          e.added.swap(added);
+          e.erased.swap(erased);
+        }
+        added.clear();
+        erased.clear();
+        cur.saved_id = cur.next_id;
       }
-      
+
+      e.links_added.swap(links_added);
+      e.links_removed.swap(links_removed);
+      writer.push(std::move(e));
     }
   }
 
-  void load(const std::string& file,int page){
+  // save and wait for it to hit the disk
+  void flush(){
+    save();
+    writer.checkpoint(true);
+    writer.flush();
+    report();
+  }
+
+  // says so on screen when the writer couldn't commit, what it had stays queued for the next try
+  void report(){
+    std::string why;
+    if (writer.failure(why))
+      error_msg(fb,why);
+  }
+
+  // the page is saved, the log checkpointed and the database tidied once the pen has been idle for a while
+  ui::TimerPtr idle_timer;
+  void touch(){
+    commit();
+    report();
+    if (idle_timer)
+      ui::cancel_timer(idle_timer);
+    idle_timer = ui::set_timeout([this](){
+      idle_timer = nullptr;
+      save();
+      writer.checkpoint();
+      writer.maintain();
+    },idle_ms);
+  }
+
+  // closes once the writer has been through a maintenance pass, now and then one that checks the tables too.
+  // waking up first just keeps it open
+  ui::TimerPtr sleep_timer;
+  void sleep(){
     if (!db) return;
-    unload();
+    save();
+    bool check = upgraded || ++sleeps >= sleeps_per_check;
+    if (check){
+      upgraded = false;
+      sleeps = 0;
+    }
+    writer.maintain(check);
+    if (sleep_timer)
+      ui::cancel_timer(sleep_timer);
+    sleep_timer = ui::set_interval([this](){
+      if (writer.maintaining()) return;
+      close();
+    },250);
+  }
 
+  // a page that was shown recently or read ahead is swapped in, anything else is read here.
+  // the page being left stays decoded in cache and the writer reads whichever page either
+  // side of the new one is missing. the oldest pages go once cache is over cache_budget
+  void load(const std::string& file,int number){
+    if (!db) return;
+    save();
 
-    current_file = file;
-    current_page = page;
+    added.clear();
+    erased.clear();
+    links_added.clear();
+    links_removed.clear();
+    deselect();
 
-    
+    std::vector<page> got;
+    writer.fetched(got);
+    for (page& p : got)
+      if (forget_read(p.file,p.number))
+        cache.push_back(std::move(p));
+    if (loaded)
+      cache.push_back(std::move(cur));
 
-    sql_bind(read_s,"si",file.c_str(),page);
-    int t = 0;
-    while ((t=sqlite3_step(read_s)) != SQLITE_DONE){
-      if (t == SQLITE_ROW) {
-        stroke st = {
-          sqlite3_column_int(read_s,0),
-          sqlite3_column_int(read_s,1),
-          sqlite3_column_int(read_s,2),
-          sqlite3_column_int(read_s,3),
-          (char)sqlite3_column_int(read_s,4),
-          (char)sqlite3_column_int(read_s,5),
-          (char)sqlite3_column_int(read_s,6),
-          (char)sqlite3_column_int(read_s,7),
-        };
-        add(st);
+    current_file = file;
+    current_page = number;
+
+    int k = find_cached(file,number);
+    if (k >= 0){
+      cur = std::move(cache[k]);
+      cache.erase(cache.begin()+k);
+      cache_hits++;
+    } else {
+      cache_misses++;
+      // a read still on its way would be older than whatever gets drawn on the page now
+      if (forget_read(file,number)){
+        writer.drop_reads();
+        reading.clear();
       }
-      
+      cur = blank(file,number);
+      if (writer.pending(file,number))
+        writer.flush();
+      // 0 when nothing was ever saved on the page, which matches no rows
+      reader.read(cur,pages.page_id(file,number,false));
     }
 
-
-    sql_bind(read_l,"si",file.c_str(),page);
-    t = 0;
-    while ((t=sqlite3_step(read_l)) != SQLITE_DONE){
-      if (t == SQLITE_BUSY) continue;
-      if (t == SQLITE_ROW) {
-        const unsigned char* s = sqlite3_column_text(read_l,0);
-        std::string t((const char*)s);
-        add_link(sqlite3_column_int(read_l,2),sqlite3_column_int(read_l,3),t);
-        continue;
+    size_t used = 0;
+    for (k = (int)cache.size()-1 ; k >= 0 ; k--)
+      if ((used += cache[k].bytes()) > cache_budget){
+        cache.erase(cache.begin(),cache.begin()+k+1);
+        break;
       }
-    }
-    
+    for (int n : {number-1,number+1})
+      if (n >= 0 && find_cached(file,n) < 0 && !forget_read(file,n,false)){
+        reading.emplace_back(file,n);
+        writer.prefetch(blank(file,n));
+      }
+
     loaded = true;
-    edited = false;
-    linksedited = false;
 
     y_scroll = 0;
           
   }
 
+  page blank(const std::string& file,int number){
+    page p;
+    p.file = file;
+    p.number = number;
+    return p;
+  }
+
+  int find_cached(const std::string& file,int number){
+    for (int k = 0 ; k < (int)cache.size() ; k++)
+      if (cache[k].number == number && cache[k].file == file) return k;
+    return -1;
+  }
+
+  // whether the page was being read, it stops being so unless erase is false
+  bool forget_read(const std::string& file,int number,bool erase = true){
+    for (int k = 0 ; k < (int)reading.size() ; k++)
+      if (reading[k].second == number && reading[k].first == file){
+        if (erase) reading.erase(reading.begin()+k);
+        return true;
+      }
+    return false;
+  }
+
   ~grid() {
     unload();
     close();
@@ -322,94 +1989,368 @@ struct grid{
   void unload() {
     if (!db) return;
     save();
-    rows.clear();
+    cur = page();
+    cache.clear();
+    reading.clear();
+    writer.drop_reads();
     loaded = false;
   }
 
   
   
+  void insert(const stroke& st){
+    cur.insert(st);
+  }
   void add(stroke& st){
-    int i = st.ax / row_w;
-    int j = st.ay / row_h;
-    if (j>=(int)rows.size()){
-      rows.resize(j+1);
+    st.id = cur.next_id++;
+    added.push_back(st);
+    op.came.push_back(st);
+    insert(st);
+  }
+  // the pen going down at a point
+  void begin_stroke(int x,int y,char width,unsigned char pressure = 255){
+    end_stroke();
+    pen_pts.clear();
+    pen = stroke();
+    pen.width = width;
+    pen.begin(pen_pts,x,y,pressure);
+    drawing = true;
+  }
+  // carries on the line under the pen, or starts a new one if it didn't end at a
+  void extend_stroke(int ax,int ay,int bx,int by,char width,unsigned char pressure = 255){
+    if (!drawing || !(pen.last(pen_pts) == point{ax,ay}) || pen.width != width || !pen.add(pen_pts,bx,by,pressure)){
+      begin_stroke(ax,ay,width,pressure);
+      pen.add(pen_pts,bx,by,pressure);
     }
-    rows[j].vect[i].push_back(st);
-    edited = true;
+    pen.draw_segment(fb,pen_pts,pen.n-2,y_scroll,y,color::SCALE_16[(int)pen.color]);
   }
-  void add_link(int x,int y,std::string file){
-    int j = y / row_h;
-    if (j>=(int)rows.size()){
-      rows.resize(j+1);
+  void end_stroke(){
+    if (!drawing) return;
+    drawing = false;
+    pen.copy_to(pen_pts,cur.pts);
+    add(pen);
+  }
+
+  // strokes that were never saved just leave the journal, older ones get a tombstone.
+  // undo keeps a copy unless the stroke only came in the same step
+  void forget(const stroke& st){
+    bool fresh = false;
+    for (size_t k = 0 ; k < op.came.size() && !fresh ; k++)
+      if (op.came[k].id == st.id){
+        op.came[k] = op.came.back();
+        op.came.pop_back();
+        fresh = true;
+      }
+    if (!fresh){
+      op.gone.push_back(st);
+      op.gone.back().copy_to(cur.pts,op.pts);
     }
-    auto s = stbtext::get_text_size(file,link_size);
-    rows[j].links.push_back(file_link{x,y,s.w,file});
-    linksedited = true;
+    if (st.id >= cur.saved_id)
+      for (int k = (int)added.size()-1 ; k >= 0 ; k--)
+        if (added[k].id == st.id){
+          added[k] = added.back();
+          added.pop_back();
+          return;
+        }
+    erased.push_back(st.id);
+  }
+
+  file_link insert_link(int x,int y,std::string file){
+    auto w = link_widths.find(file);
+    if (w == link_widths.end())
+      w = link_widths.emplace(file,link_width(file)).first;
+    return cur.insert_link(x,y,file,w->second);
+  }
+  void add_link(int x,int y,std::string file){
+    put_link(insert_link(x,y,file));
+    commit();
+  }
+  void put_link(const file_link& l){
+    links_added.push_back(l);
+    op.links_came.push_back(l);
   }
 
 
   file_link* get_link(int x,int y){
-    int j = y / row_h;
-    
-    for (int i = max(0,j-1); i <= min(j+1,rows.size()-1); i++){
-      for (file_link& l : rows[i].links){
-        if (x < l.x - 10 || x > l.x+l.w+10) continue;
-        if (y < l.y - link_size - 10 || y > l.y + 10) continue;
-        return &l;
-      }
-    }
-    return nullptr;
+    file_link* found = nullptr;
+    cur.links.each(box{x,y,x,y},[&](file_link& l){
+      if (!found) found = &l;
+    });
+    return found;
   }
 
   void remove_link(int x,int y){
-    int j = y / row_h;
-        
-    for (int i = max(0,j-1); i <= min(j+1,rows.size()-1); i++){
-      for (int k = rows[i].links.size()-1; k >= 0; k--){
-        auto& l = rows[i].links[k];
-        if (x < l.x - 10 || x > l.x+l.w+10) continue;
-        if (y < l.y - link_size - 10 || y > l.y + 10) continue;
-        rows[i].links.erase(rows[i].links.begin()+k);
-        linksedited = true;
-        return;
+    bool done = false;
+    cur.links.erase_if(box{x,y,x,y},[&](file_link& l){
+      if (done) return false;
+      take_link(l);
+      return done = true;
+    });
+    commit();
+  }
+  // the same bookkeeping as forget for a link that has been taken off the page
+  void take_link(const file_link& l){
+    auto same = [&](const file_link& k){ return k.x == l.x && k.y == l.y && k.file == l.file; };
+    bool fresh = false;
+    for (int n = (int)links_added.size()-1 ; n >= 0 && !fresh ; n--)
+      if (same(links_added[n])){
+        links_added.erase(links_added.begin()+n);
+        fresh = true;
+      }
+    if (!fresh)
+      links_removed.push_back(l);
+    fresh = false;
+    for (int n = (int)op.links_came.size()-1 ; n >= 0 && !fresh ; n--)
+      if (same(op.links_came[n])){
+        op.links_came.erase(op.links_came.begin()+n);
+        fresh = true;
       }
+    if (!fresh)
+      op.links_gone.push_back(l);
+  }
+
+  // what has been done since the pen went down becomes one step of undo
+  void commit(){
+    if (op.empty()) return;
+    op.file = current_file;
+    op.page = current_page;
+    push(undo_log);
+    redo_log.clear();
+  }
+  void push(std::deque<page_op>& log){
+    log.push_back(std::move(op));
+    op = page_op();
+    size_t used = 0;
+    for (page_op& o : log)
+      used += o.bytes();
+    while (used > undo_budget && log.size() > 1){
+      used -= log.front().bytes();
+      log.pop_front();
     }
   }
 
-  
-  
+  // takes back the last step, false if there is none. it goes to the page it was on, area is
+  // what has to be redrawn there
+  bool undo(box& area){
+    return step(undo_log,redo_log,area);
+  }
+  bool redo(box& area){
+    return step(redo_log,undo_log,area);
+  }
+  bool step(std::deque<page_op>& from,std::deque<page_op>& to,box& area){
+    end_stroke();
+    commit();
+    if (from.empty()) return false;
+    page_op o = std::move(from.back());
+    from.pop_back();
+    area = apply(o);
+    // a move that failed is still to be done
+    if (o.moved && !op.moved) from.push_back(std::move(o));
+    else push(to);
+    return true;
+  }
+  // does o backwards, which leaves the step that does it forwards again in op. costs what o
+  // holds, the strokes that came are found by their boxes
+  box apply(page_op& o){
+    box area = stroke().bb;
+    deselect();
+    if (o.moved){
+      // the page went from file:page to to:to_page, back up its own document it has to go in
+      // front of the page after the one it left
+      bool up = o.to == o.file && o.to_page < o.page;
+      op.to_page = move_page(o.to,o.to_page,o.file,up ? o.page+1 : o.page);
+      if (op.to_page < 0) return area;
+      op.moved = true;
+      op.file = o.to;
+      op.page = o.to_page;
+      op.to = o.file;
+      return area;
+    }
+    if (!loaded || o.file != current_file || o.page != current_page)
+      load(o.file,o.page);
+    std::unordered_set<unsigned int> ids;
+    box q = stroke().bb;
+    for (stroke& st : o.came){
+      ids.insert(st.id);
+      q = join(q,st.bb);
+    }
+    cur.strokes.erase_if(q,[&](stroke& st){
+      if (!ids.count(st.id)) return false;
+      forget(st);
+      area = join(area,st.drawn());
+      return true;
+    });
+    std::unordered_map<unsigned int,unsigned int> renamed;
+    for (stroke st : o.gone){
+      unsigned int was = st.id;
+      st.copy_to(o.pts,cur.pts);
+      add(st);
+      renamed[was] = st.id;
+      area = join(area,st.drawn());
+    }
+    rename(renamed);
+    for (file_link& l : o.links_came){
+      bool done = false;
+      cur.links.erase_if(box{l.x,l.y,l.x,l.y},[&](file_link& k){
+        if (done || k.x != l.x || k.y != l.y || k.file != l.file) return false;
+        take_link(k);
+        return done = true;
+      });
+      area = join(area,box{l.x,l.y-link_size,l.x+l.w,l.y});
+    }
+    for (file_link& l : o.links_gone){
+      put_link(insert_link(l.x,l.y,l.file));
+      area = join(area,box{l.x,l.y-link_size,l.x+l.w,l.y});
+    }
+    op.file = current_file;
+    op.page = current_page;
+    return area;
+  }
+
+  // a stroke that comes back gets a new id, its old one may already have a tombstone. the
+  // other steps on this page still know it by the old one
+  void rename(const std::unordered_map<unsigned int,unsigned int>& ids){
+    if (ids.empty()) return;
+    auto swap_ids = [&](std::vector<stroke>& v){
+      for (stroke& st : v){
+        auto k = ids.find(st.id);
+        if (k != ids.end()) st.id = k->second;
+      }
+    };
+    for (std::deque<page_op>* log : {&undo_log,&redo_log})
+      for (page_op& o : *log)
+        if (!o.moved && o.file == current_file && o.page == current_page){
+          swap_ids(o.came);
+          swap_ids(o.gone);
+        }
+  }
 
   void draw(){
-    int j_st = max(y_scroll/row_h,0);
-    int s = (int)rows.size();
-    if (j_st >= s) return;
-    int j_end = min((y_scroll+h)/row_h,s-1);
-    
-    for (int j = j_st ; j <= j_end ; j++){
-      for (int i = 0 ; i < 16 ; i++)
-        for (stroke& k : rows[j].vect[i])
-          k.draw(fb,y_scroll,y);
-      for (file_link& l : rows[j].links)
-        if (l.y > y_scroll + link_size)
-          fb->draw_text(l.x,l.y-y_scroll+y-link_size,l.file,link_size);
+    draw(box{-(1<<30),y_scroll,1<<30,y_scroll+h});
+  }
+
+  // what overlaps q, in page coordinates
+  void draw(const box& q){
+    // strokes are found by their points, half the widest brush reaches past them
+    int pad = max_width/2 + 1;
+    cur.strokes.each(box{q.x0-pad,q.y0-pad,q.x1+pad,q.y1+pad},[&](stroke& k){
+      k.draw(fb,cur.pts,y_scroll,y);
+    });
+    if (drawing) pen.draw(fb,pen_pts,y_scroll,y);
+    cur.links.each(box{q.x0,q.y0,q.x1,q.y1+link_size},[&](file_link& l){
+      if (l.y > y_scroll + link_size)
+        fb->draw_text(l.x,l.y-y_scroll+y-link_size,l.file,link_size);
+    });
+  }
+
+  // picks the strokes with most of their points inside the lasso, returns how many
+  int select(const std::vector<point>& lasso){
+    selected.clear();
+    sel_box = stroke().bb;
+    if (lasso.size() < 3) return 0;
+    box q = stroke().bb;
+    for (const point& p : lasso)
+      q = join(q,box{p.x,p.y,p.x,p.y});
+    cur.strokes.each(q,[&](stroke& st){
+      int in = 0;
+      for (int i = 0 ; i < (int)st.n ; i++)
+        in += inside(lasso,st.at(cur.pts,i));
+      if (in*2 <= (int)st.n) return;
+      selected.insert(st.id);
+      sel_box = join(sel_box,st.drawn());
+    });
+    return (int)selected.size();
+  }
+
+  // forgets the selection, returns where its box was
+  box deselect(){
+    selected.clear();
+    box b = sel_box;
+    sel_box = stroke().bb;
+    return b;
+  }
+
+  // moves the selection by dx,dy after scaling it by s from its top left corner. the
+  // strokes are changed where they are and saved under new ids like the eraser's pieces.
+  // returns what has to be redrawn, where they were and where they are now
+  box transform(int dx,int dy,double s){
+    box old = sel_box;
+    if (selected.empty()) return old;
+    // a scaled stroke's points have to stay in reach of its origin
+    int size = std::max(old.x1-old.x0,old.y1-old.y0);
+    if (size*s > SHRT_MAX) s = (double)SHRT_MAX/size;
+    std::vector<stroke> moved;
+    cur.strokes.erase_if(old,[&](stroke& st){
+      if (!selected.count(st.id)) return false;
+      forget(st);
+      moved.push_back(st);
+      return true;
+    });
+    selected.clear();
+    sel_box = stroke().bb;
+    for (stroke& st : moved){
+      point o = st.at(cur.pts,0);
+      int nx = old.x0 + (int)lround((o.x-old.x0)*s) + dx, ny = old.y0 + (int)lround((o.y-old.y0)*s) + dy;
+      st.bb = stroke().bb;
+      for (int i = 0 ; i < (int)st.n ; i++){
+        point p = st.at(cur.pts,i);
+        int ox = (int)lround((p.x-o.x)*s), oy = (int)lround((p.y-o.y)*s);
+        cur.pts.xs[st.first+i] = (short)ox;
+        cur.pts.ys[st.first+i] = (short)oy;
+        st.grow(nx+ox,ny+oy);
+      }
+      st.x = nx;
+      st.y = ny;
+      st.width = (char)std::max(1,std::min(max_width,(int)lround(st.width*s)));
+      add(st);
+      selected.insert(st.id);
+      sel_box = join(sel_box,st.drawn());
     }
+    return join(old,sel_box);
   }
 
+
+  // rubs out every segment the eraser touched on its way from a to b, r being its radius.
+  // whatever is left of a stroke becomes new strokes
+  void remove(int ax,int ay,int bx,int by,int r){
+    end_stroke();
+    std::vector<stroke> rest;
+    std::vector<char> gone;
+    point a{ax,ay}, b{bx,by};
+    // half the widest brush, strokes are found by their points
+    int pad = r + max_width/2 + 1;
+    box q{std::min(ax,bx)-pad,std::min(ay,by)-pad,std::max(ax,bx)+pad,std::max(ay,by)+pad};
+    cur.strokes.erase_if(q,[&](stroke& st){
+      int n = st.segments();
+      double reach = r + st.width/2.0;
+      bool any = false;
+      gone.assign(n,0);
+      for (int i = 0 ; i < n ; i++){
+        point c = st.at(cur.pts,i), d = st.at(cur.pts,i+1 < (int)st.n ? i+1 : i);
+        if (dist_sq(c,d,a,b) <= reach*reach){
+          st.draw_segment(fb,cur.pts,i,y_scroll,this->y,WHITE);
+          gone[i] = 1;
+          any = true;
+        }
+      }
+      if (!any) return false;
+      // the pieces keep pointing at the same points
+      for (int i = 0 ; i < n ; i++){
+        if (gone[i]) continue;
+        int j = i;
+        while (j < n && !gone[j]) j++;
+        rest.push_back(st.slice(cur.pts,i,j));
+        i = j;
+      }
+      forget(st);
+      return true;
+    });
+    // the tree can't take new strokes while it is being walked
+    for (stroke& st : rest)
+      add(st);
+  }
   void remove(int x,int y,int r){
-    int end_i = (x+r+1)/row_w;
-    int end_j = (y+r+1)/row_h;
-    for (int j = (y-r-1)/row_h;j<=end_j;j++)
-      for (int i = (x-r-1)/row_w;i<=end_i;i++)
-        if (j < (int)rows.size())
-          for (int k = rows[j].vect[i].size()-1 ; k>= 0; k--){
-            stroke& st = rows.at(j).vect[i].at(k);
-            if (lensq(st.ax-x,st.ay-y) <= r*r) {
-              st.undraw(fb,y_scroll,this->y);
-              rows[j].vect[i].erase(rows[j].vect[i].begin()+k);
-            }
-          }
-        
-    edited = true;
+    remove(x,y,x,y,r);
   }
 };
 
@@ -442,6 +2383,14 @@ public:
     int drag_x=-1,drag_y=-1;
 
     bool erased = false,click_start = false;
+    int ex = -1,ey = -1; // the eraser's last position
+
+    // select tool, in page coordinates. the lasso being drawn, or what dragging the
+    // selection does (1 moves it, 2 scales it from its corner) from where the pen went down
+    std::vector<point> lasso;
+    int sel_drag = 0,sel_x,sel_y;
+    box outline = stroke().bb; // where the selection's box is drawn
+    const int handle = 24;
 
     void refresh_screen(){
       ui::MainLoop::refresh();
@@ -459,6 +2408,148 @@ public:
       render();
     }
 
+    // how much of the brush width the pen gets, out of 255. no pressure reading is the whole width
+    unsigned char pressure(input::SynMotionEvent& e){
+      if (e.pressure < 0) return 255;
+      float f = min_pressure_width + (1-min_pressure_width)*std::min(1.0f,e.pressure/full_pressure);
+      return (unsigned char)lround(255*f);
+    }
+
+    void set_tool(int t){
+      if (t != SELECT && !gr.selected.empty())
+        redraw(gr.deselect());
+      tool = t;
+    }
+
+    void draw_lines(int left,int top,int right,int bottom){
+      if (!lines) return;
+      int y_s = lines - gr.y_scroll % lines;
+      for (int i = y_s ; i < h; i+=lines)
+        if (i >= top && i <= bottom)
+          fb->draw_line(left,y+i,right,y+i,1,color::SCALE_16[8]);
+    }
+
+    // draws part of the page again, a is in page coordinates
+    void redraw(box a){
+      int left = std::max(a.x0-2,0), right = std::min(a.x1+2,w-1);
+      int top = std::max(a.y0-2-gr.y_scroll,1), bottom = std::min(a.y1+2-gr.y_scroll,h-1);
+      if (left > right || top > bottom) return;
+      fb->draw_rect(left,y+top,right-left+1,bottom-top+1,WHITE,true);
+      draw_lines(left,top,right,bottom);
+      gr.draw(box{left,top+gr.y_scroll,right,bottom+gr.y_scroll});
+    }
+
+    // the box around the selection with a handle at its corner to scale it by
+    void draw_outline(box b){
+      outline = b;
+      int left = std::max(b.x0,0), right = std::min(b.x1,w-1);
+      int top = std::max(b.y0-gr.y_scroll,1), bottom = std::min(b.y1-gr.y_scroll,h-1);
+      if (left > right || top > bottom) return;
+      fb->draw_rect(left,y+top,right-left+1,bottom-top+1,color::SCALE_16[6],false);
+      int hx = b.x1-handle/2, hy = b.y1-gr.y_scroll-handle/2;
+      if (hx >= 0 && hx+handle < w && hy >= 1 && hy+handle < h)
+        fb->draw_rect(hx,y+hy,handle,handle,BLACK,true);
+    }
+    // redraws just the strips under the outline
+    void undraw_outline(){
+      box b = outline;
+      if (b.x0 > b.x1) return;
+      int r = handle/2+1;
+      redraw(box{b.x0,b.y0,b.x1,b.y0});
+      redraw(box{b.x0,b.y1,b.x1,b.y1});
+      redraw(box{b.x0,b.y0,b.x0,b.y1});
+      redraw(box{b.x1,b.y0,b.x1,b.y1});
+      redraw(box{b.x1-r,b.y1-r,b.x1+r,b.y1+r});
+      outline = stroke().bb;
+    }
+
+    // where the selection would go with the pen at p, as a move and a scale
+    void sel_target(point p,int& dx,int& dy,double& s){
+      box b = gr.sel_box;
+      dx = dy = 0;
+      s = 1;
+      if (sel_drag == 1){
+        dx = p.x-sel_x;
+        dy = p.y-sel_y;
+      } else if (sel_drag == 2){
+        int bw = std::max(b.x1-b.x0,1), bh = std::max(b.y1-b.y0,1);
+        s = ((double)(bw+p.x-sel_x)/bw + (double)(bh+p.y-sel_y)/bh)/2;
+        s = std::max(0.1,std::min(8.0,s));
+      }
+    }
+    box sel_preview(point p){
+      int dx,dy;
+      double s;
+      sel_target(p,dx,dy,s);
+      box b = gr.sel_box;
+      return box{b.x0+dx,b.y0+dy,b.x0+dx+(int)((b.x1-b.x0)*s),b.y0+dy+(int)((b.y1-b.y0)*s)};
+    }
+
+    void select_down(point p){
+      box b = gr.sel_box;
+      sel_drag = 0;
+      sel_x = p.x;
+      sel_y = p.y;
+      if (!gr.selected.empty()){
+        if (my_abs(p.x-b.x1) <= handle && my_abs(p.y-b.y1) <= handle) sel_drag = 2;
+        else if (b.overlaps(box{p.x,p.y,p.x,p.y})) sel_drag = 1;
+        else redraw(gr.deselect());
+      }
+      lasso.clear();
+      if (!sel_drag) lasso.push_back(p);
+    }
+    void select_move(point p){
+      if (sel_drag){
+        undraw_outline();
+        draw_outline(sel_preview(p));
+      } else if (lasso.size() && lensq(p.x-lasso.back().x,p.y-lasso.back().y) > 64){
+        point& l = lasso.back();
+        fb->draw_line(l.x,l.y-gr.y_scroll+y,p.x,p.y-gr.y_scroll+y,1,color::SCALE_16[6]);
+        lasso.push_back(p);
+      }
+    }
+    void select_up(point p){
+      if (sel_drag){
+        int dx,dy;
+        double s;
+        sel_target(p,dx,dy,s);
+        undraw_outline();
+        redraw(gr.transform(dx,dy,s));
+        draw_outline(gr.sel_box);
+      } else if (lasso.size()){
+        box lb = stroke().bb;
+        double area = 0;
+        for (size_t i = 0, j = lasso.size()-1 ; i < lasso.size() ; j = i++){
+          lb = join(lb,box{lasso[i].x,lasso[i].y,lasso[i].x,lasso[i].y});
+          area += (double)lasso[j].x*lasso[i].y - (double)lasso[i].x*lasso[j].y;
+        }
+        // a straight drag or a thin loop means the box it spans
+        if (lasso.size() < 3 || my_abs(area)/2 < 0.1*(double)(lb.x1-lb.x0)*(lb.y1-lb.y0))
+          lasso = {point{lb.x0,lb.y0},point{lb.x1,lb.y0},point{lb.x1,lb.y1},point{lb.x0,lb.y1}};
+        redraw(lb);
+        if (gr.select(lasso)) draw_outline(gr.sel_box);
+      }
+      lasso.clear();
+      sel_drag = 0;
+    }
+
+    // a step of undo or redo, only what it touched is drawn again unless it was on another page
+    void undo(bool redo = false){
+      std::string file = gr.current_file;
+      int page = gr.current_page;
+      box sel = gr.selected.empty() ? stroke().bb : gr.sel_box;
+      box area;
+      if (!(redo ? gr.redo(area) : gr.undo(area))) return;
+      if (gr.loaded && gr.current_file == file && gr.current_page == page){
+        redraw(sel);
+        redraw(area);
+        gr.touch();
+      } else {
+        load(gr.current_file,gr.current_page);
+        rerender();
+      }
+    }
+
     void load(std::string file = "Home",int page = 0){
       pagenum->undraw();
       pagenum->text = file+":"+std::to_string(page);
@@ -474,7 +2565,7 @@ public:
           load();
           rerender();
         };
-        gr.init(w,h,y,fb);
+        gr.init(h,y,fb);
         dirty = 1;
 
         gestures.drag_start += PLS_LAMBDA(auto& e){
@@ -524,7 +2615,7 @@ public:
     }
     void on_mouse_enter(input::SynMotionEvent& e){
         if (input::is_wacom_event(e)){
-          px = py = -1;
+          px = py = ex = ey = -1;
           if ((e.left && e.left!=-1) || (e.eraser && e.eraser!=-1)) {
             px = e.x;
             py = e.y;
@@ -534,14 +2625,19 @@ public:
 
     void on_mouse_leave(input::SynMotionEvent& e){
         if (input::is_wacom_event(e)){
-          px = py = -1;
+          px = py = ex = ey = -1;
+          gr.end_stroke();
+          if (tool == SELECT) select_up(point{e.x,e.y+gr.y_scroll-y});
           if (erased) {dirty = 1;erased=false;}  
         }
     }
 
     void on_mouse_up(input::SynMotionEvent& e){
         if (input::is_wacom_event(e)){
-          px = py = -1;
+          px = py = ex = ey = -1;
+          gr.end_stroke();
+          if (tool == SELECT) select_up(point{e.x,e.y+gr.y_scroll-y});
+          gr.touch();
           if (erased) {dirty = 1;erased=false;}  
 
           if (click_start) {
@@ -567,11 +2663,11 @@ public:
     }
     void on_mouse_down(input::SynMotionEvent& e){
         if (input::is_wacom_event(e)){
-          px = py = -1;
-          if (tool == DRAW) { // this mess is for dots since I wanted to make sure that strokes would have a minimum size otherwise
-            stroke st = stroke{e.x,e.y+gr.y_scroll-y,e.x,e.y+gr.y_scroll-y,width,0,0,0};
-            gr.add(st); 
-          }
+          px = py = ex = ey = -1;
+          if (tool == DRAW) // a stroke starts as a dot so a tap still leaves a mark
+            gr.begin_stroke(e.x,e.y+gr.y_scroll-y,width,pressure(e));
+          if (tool == SELECT && e.left && e.left!=-1)
+            select_down(point{e.x,e.y+gr.y_scroll-y});
           if (e.left && e.left!=-1) 
             if (tool == LINK || tool == REM_LINK)
               click_start = true;
@@ -608,13 +2704,17 @@ public:
           
           if ((e.eraser && e.eraser!=-1) || tool==ERASER){
               px = -2;
-              gr.remove(e.x,e.y+gr.y_scroll-y,eraser_width*8);
+              // from where the last event left it so a quick swipe doesn't skip anything
+              if (ex < 0) ex = e.x, ey = e.y;
+              gr.remove(ex,ey+gr.y_scroll-y,e.x,e.y+gr.y_scroll-y,eraser_width*8);
+              ex = e.x;
+              ey = e.y;
               erased = true;
+          } else if (tool==SELECT){
+              select_move(point{e.x,e.y+gr.y_scroll-y});
           } else if (px < 0 || lensq(e.x-px,e.y-py) > min(16,(width/2)*(width/2))){
             if (tool==DRAW && px >= 0){
-               stroke st = stroke{px,py+gr.y_scroll-y,e.x,e.y+gr.y_scroll-y,width,0,0,0};
-               gr.add(st);
-               st.draw(fb,gr.y_scroll,y);
+               gr.extend_stroke(px,py+gr.y_scroll-y,e.x,e.y+gr.y_scroll-y,width,pressure(e));
             }
           
             px = e.x;
@@ -637,13 +2737,9 @@ public:
     void render(){
         fb->draw_rect(x, y, w, h, WHITE, true);
         
-        if (lines) {
-          int y_s = lines - gr.y_scroll % lines;
-          for (int i = y_s ; i < h; i+=lines) {
-            fb->draw_line(0,y+i,w,y+i,1,color::SCALE_16[8]);
-          }
-        }
+        draw_lines(0,0,w,h);
         gr.draw();
+        if (!gr.selected.empty()) draw_outline(gr.sel_box);
         
         fb->draw_line(0,y,w,y,1,BLACK);
 
@@ -675,7 +2771,7 @@ class ToolDropdown : public ui::TextDropdown{
       NB->width = widths[i-NB->NUM_TOOLS];
       return;
     }
-    NB->tool = i;
+    NB->set_tool(i);
   }
 };
 
@@ -751,6 +2847,20 @@ int main(int,char**){
       }; 
       scene->add(b);
     }
+    {
+      ui::Button* b = new ui::Button(256,0,32,tool_height,"<");
+      b->mouse.click += [=] (input::SynMotionEvent&){
+        N->undo();
+      }; 
+      scene->add(b);
+    }
+    {
+      ui::Button* b = new ui::Button(288,0,32,tool_height,">");
+      b->mouse.click += [=] (input::SynMotionEvent&){
+        N->undo(true);
+      }; 
+      scene->add(b);
+    }
     
 
 
@@ -758,6 +2868,9 @@ int main(int,char**){
 
 
     ui::MainLoop::motion_event += PLS_DELEGATE(N->handle_motion_event);
+    ui::MainLoop::exit += [=](int){
+      N->gr.close();
+    };
 
     
     ui::MainLoop::key_event += [&](input::SynKeyEvent& e) {
@@ -768,10 +2881,10 @@ int main(int,char**){
             if (sleep) {
               N->kb.hide();
               N->fb->clear_screen();
-              N->gr.save();
+              N->gr.flush();
               ui::MainLoop::set_scene(sleep_scene);
               N->refresh_screen();
-              N->gr.close();
+              N->gr.sleep();
             }
             else {
               N->fb->clear_screen();
@@ -20942,6 +20942,11 @@ namespace input {
 #include <sys/ioctl.h>
 #include <ctime>
 #include <linux/limits.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 
 #include <fstream>
@@ -20965,10 +20970,59 @@ namespace framebuffer {
     struct stat buffer;
     return (stat (name.c_str(), &buffer) == 0); };
 
+  // row kernels: a vector register of pixels per store where the target has one (NEON on
+  // the device, AVX2 or SSE2 on a host), the tail and anything else a pixel at a time
+  inline void fill_row(remarkable_color *dst, int n, remarkable_color c) {
+    auto i = 0;
+    #if defined(__ARM_NEON) || defined(__AVX2__) || defined(__SSE2__)
+    remarkable_color pat[32/sizeof(remarkable_color)];
+    for (auto &p : pat) {
+      p = c; }
+    #endif
+    #if defined(__ARM_NEON)
+    auto v = vld1q_u8((const uint8_t*) pat);
+    for (; i+(int)(16/sizeof(remarkable_color)) <= n; i += 16/sizeof(remarkable_color)) {
+      vst1q_u8((uint8_t*) (dst+i), v); }
+    #elif defined(__AVX2__)
+    auto v = _mm256_loadu_si256((const __m256i*) pat);
+    for (; i+(int)(32/sizeof(remarkable_color)) <= n; i += 32/sizeof(remarkable_color)) {
+      _mm256_storeu_si256((__m256i*) (dst+i), v); }
+    #elif defined(__SSE2__)
+    auto v = _mm_loadu_si128((const __m128i*) pat);
+    for (; i+(int)(16/sizeof(remarkable_color)) <= n; i += 16/sizeof(remarkable_color)) {
+      _mm_storeu_si128((__m128i*) (dst+i), v); }
+    #endif
+    for (; i < n; i++) {
+      dst[i] = c; } }
+
+  inline void copy_row(remarkable_color *dst, const remarkable_color *src, int n) {
+    auto i = 0;
+    #if defined(__ARM_NEON)
+    for (; i+(int)(16/sizeof(remarkable_color)) <= n; i += 16/sizeof(remarkable_color)) {
+      vst1q_u8((uint8_t*) (dst+i), vld1q_u8((const uint8_t*) (src+i))); }
+    #elif defined(__AVX2__)
+    for (; i+(int)(32/sizeof(remarkable_color)) <= n; i += 32/sizeof(remarkable_color)) {
+      _mm256_storeu_si256((__m256i*) (dst+i), _mm256_loadu_si256((const __m256i*) (src+i))); }
+    #elif defined(__SSE2__)
+    for (; i+(int)(16/sizeof(remarkable_color)) <= n; i += 16/sizeof(remarkable_color)) {
+      _mm_storeu_si128((__m128i*) (dst+i), _mm_loadu_si128((const __m128i*) (src+i))); }
+    #endif
+    for (; i < n; i++) {
+      dst[i] = src[i]; } }
+
   class FBRect {
     public:
     int x0, y0, x1, y1; };
 
+  class FBSpan {
+    public:
+    int next, x0, x1, hull; };
+
+  class FBPolyPoint {
+    public:
+    int x, y;
+    float r; };
+
   class FBImageData {
     public:
     int x, y, w, h;
@@ -21108,7 +21162,7 @@ namespace framebuffer {
       return; }
 
     inline void _set_pixel(remarkable_color *dst, int x, int y, remarkable_color c) {
-      *dst = this->dither(x, y, c); }
+      *dst = this->dither == DITHER::NONE ? c : this->dither(x, y, c); }
 
     inline void _set_pixel(int x, int y, remarkable_color c) {
       this->_set_pixel(&this->fbmem[y*this->width+x], x, y, c); }
@@ -21209,16 +21263,66 @@ namespace framebuffer {
 
       if (o_y >= this->height || o_x >= this->width || o_y < 0 || o_x < 0) {
         return; }
+      w = min(w, this->width-o_x);
+      h = min(h, this->height-o_y);
 
-      for (auto j = 0; j < h; j++) {
-        if (j+o_y >= this->height) {
-          break; }
+      if (unlikely(dither != 1.0)) {
+        for (auto j = 0; j < h; j++) {
+          for (auto i = 0; i < w; i++) {
+            do_dithering(this->fbmem, i+o_x, j+o_y, color, dither); } }
+        return; }
 
-        for (auto i = 0; i < w; i++) {
-          if (i+o_x >= this->width) {
-            break; }
+      if (this->dither == DITHER::NONE) {
+        _fill_rect<true>(o_x, o_y, w, h, color); }
+      else {
+        _fill_rect<false>(o_x, o_y, w, h, color); } }
+
+    // what do_dithering does a row at a time with the pattern picked once per rect. plain
+    // is for when the dither mode is NONE, rows are then filled or copied by the row kernels
+    template<bool plain>
+    inline void _fill_rect(int o_x, int o_y, int w, int h, int color) {
+      auto px = [this](int x, int y, remarkable_color c) {
+        return plain ? c : this->dither(x, y, c); };
+
+      if (plain && color != GRAY && color != ERASER_RUBBER && color != ERASER_STYLUS) {
+        // whole rows are one run of memory
+        if (w == this->width) {
+          fill_row(&this->fbmem[o_y*this->width], w*h, color);
+          return; }
+        for (auto j = o_y; j < o_y+h; j++) {
+          fill_row(&this->fbmem[j*this->width+o_x], w, color); }
+        return; }
 
-          do_dithering(this->fbmem, i+o_x, j+o_y, color, dither); } } }
+      // both patterns repeat every 6 pixels along (x+y), each row copies from where it starts
+      if (plain && (color == GRAY || color == ERASER_RUBBER)) {
+        this->pattern_row.resize(w+6);
+        for (auto k = 0; k < w+6; k++) {
+          auto white = color == GRAY ? k % 2 == 0 : k % 2 == 0 || k % 3 == 0;
+          this->pattern_row[k] = white ? WHITE : BLACK; }
+        for (auto j = o_y; j < o_y+h; j++) {
+          copy_row(&this->fbmem[j*this->width+o_x], &this->pattern_row[(o_x+j)%6], w); }
+        return; }
+
+      for (auto j = o_y; j < o_y+h; j++) {
+        auto row = &this->fbmem[j*this->width];
+        switch (color) {
+          case GRAY: {
+            for (auto i = o_x; i < o_x+w; i++) {
+              row[i] = px(i, j, (i + j) % 2 == 0 ? WHITE : BLACK); }
+            break; }
+          case ERASER_RUBBER: {
+            for (auto i = o_x; i < o_x+w; i++) {
+              row[i] = px(i, j, (i + j) % 2 == 0 || (i + j) % 3 == 0 ? WHITE : BLACK); }
+            break; }
+          case ERASER_STYLUS: {
+            for (auto i = o_x; i < o_x+w; i++) {
+              if (row[i] != WHITE && ((i + j) % 2 == 0 || (i + j) % 3 == 0)) {
+                row[i] = px(i, j, WHITE); } }
+            break; }
+          default: {
+            for (auto i = o_x; i < o_x+w; i++) {
+              row[i] = px(i, j, color); } } } } }
+    vector<remarkable_color> pattern_row;
 
     inline remarkable_color pack_pixel(char *src, int offset) {
       #ifdef RMKIT_FBINK
@@ -21253,6 +21357,15 @@ namespace framebuffer {
 
 
     auto draw_bitmap(image_data &image, int o_x, int o_y, int pseudo_alpha=ALPHA_BLEND, bool alpha=true) {
+      if (this->dither == DITHER::NONE) {
+        _draw_bitmap<true>(image, o_x, o_y, pseudo_alpha, alpha); }
+      else {
+        _draw_bitmap<false>(image, o_x, o_y, pseudo_alpha, alpha); } }
+
+    template<bool plain>
+    inline void _draw_bitmap(image_data &image, int o_x, int o_y, int pseudo_alpha, bool alpha) {
+      auto px = [this](remarkable_color *dst, int x, int y, remarkable_color c) {
+        *dst = plain ? c : this->dither(x, y, c); };
       remarkable_color* ptr = this->fbmem;
       ptr += (o_x + o_y * this->width);
       auto src = image.buffer;
@@ -21280,14 +21393,14 @@ namespace framebuffer {
             if (image.channels == 4 && alpha) {
 
               if (((char*)src)[i*image.channels+3] != 0) {
-                this->_set_pixel(&ptr[i], i, j, pack_pixel((char *) src, i*image.channels)); } }
+                px(&ptr[i], i, j, pack_pixel((char *) src, i*image.channels)); } }
             else if (image.channels >= 3) {
-              this->_set_pixel(&ptr[i], i, j, pack_pixel((char *) src, i*image.channels)); }
+              px(&ptr[i], i, j, pack_pixel((char *) src, i*image.channels)); }
             else if (image.channels == 1) {
               grayscale_to_rgb32(src[i], src_val);
-              this->_set_pixel(&ptr[i], i, j, pack_pixel(src_val, 0)); }
+              px(&ptr[i], i, j, pack_pixel(src_val, 0)); }
             else {
-              this->_set_pixel(&ptr[i], i, j, src[i]); } } }
+              px(&ptr[i], i, j, src[i]); } } }
 
         ptr += this->width;
         src += image.w; } }
@@ -21501,14 +21614,38 @@ namespace framebuffer {
 
         _draw_rect_fast(-y+x0, -x+y0, w, h, color); } }
 
+    // half the span of a filled circle of radius r on the row d away from its middle, each
+    // radius is worked out the first time it is drawn
+    vector<vector<int>> circle_spans;
+    const vector<int>& get_circle_spans(int r) {
+      if (r >= (int) this->circle_spans.size()) {
+        this->circle_spans.resize(r+1); }
+      auto &t = this->circle_spans[r];
+      if (t.empty()) {
+        t.resize(r+1);
+        for (auto d = 0, k = r; d <= r; d++) {
+          while (k*k > r*r-d*d) {
+            k--; }
+          t[d] = k; } }
+      return t; }
+
+    // every pixel of the circle stamps a stroke sized square, a square whose corner is off
+    // the top or left of the screen isn't drawn at all. the same pixels are written a row at a time
     auto draw_circle_filled(int x0, int y0, int radius, int stroke, int color) {
       update_dirty(dirty_area, x0-radius-stroke, y0-radius-stroke);
       update_dirty(dirty_area, x0+radius+stroke, y0+radius+stroke);
+      if (radius < 0) {
+        return; }
 
-      for (auto x = -radius; x <= radius; x++) {
-        for (auto y = -radius; y <= radius; y++) {
-          if ((x*x+y*y) <= radius*radius) {
-            _draw_rect_fast(x+x0, y+y0, stroke, stroke, color); } } } }
+      auto &h = get_circle_spans(radius);
+      for (auto y = -radius; y < radius+stroke; y++) {
+        auto w = -1;
+        for (auto d = max(max(y-stroke+1, -radius), -y0); d <= min(y, radius); d++) {
+          w = max(w, h[abs(d)]); }
+        auto lo = max(x0-w, 0);
+        if (w < 0 || x0+w < 0 || y+y0 < 0) {
+          continue; }
+        _draw_rect_fast(lo, y+y0, x0+w+stroke-lo, 1, color); } }
 
 
 
@@ -21525,18 +21662,53 @@ namespace framebuffer {
       else {
         this->draw_circle_outline(x0, y0, r, stroke, color); } }
 
+    // covers the same pixels as a filled circle of width/2 at every bresenham step, but
+    // finds each row's span first and writes every pixel once
     auto draw_line_circle(int x0, int y0, int x1, int y1, int width, int color, float dither=1.0) {
       #ifdef DEBUG_FB
       fprintf(stderr ,"DRAWING LINE w. CIRCLES %i %i %i %i\n", x0, y0, x1, y1);
       #endif
       this->dirty = 1;
+      auto r = width/2;
+      update_dirty(dirty_area, min(x0, x1)-r-1, min(y0, y1)-r-1);
+      update_dirty(dirty_area, max(x0, x1)+r+1, max(y0, y1)+r+1);
+      if (r < 0) {
+        return; }
+      _line_circle(x0, y0, x1, y1, r, color, 0); }
+
+    // the pixels of draw_line_circle with radius r, rows above clip_y left alone
+    void _line_circle(int x0, int y0, int x1, int y1, int r, int color, int clip_y) {
+      auto top = min(y0, y1) - r;
+      auto rows = abs(y1-y0) + 2*r + 1;
+      auto &half = get_circle_spans(r);
+      if (r) {
+        this->span_lo.assign(rows, 1<<30);
+        this->span_hi.assign(rows, -(1<<30)); }
+      auto lo = this->span_lo.data(), hi = this->span_hi.data();
+
+      // steps on the same row are one run, its circles widen the rows they reach. without a
+      // radius a run is all there is on its row and it's drawn straight away
+      auto run = [&](int a, int b, int y) {
+        if (!r) {
+          auto l = max(a, 0);
+          if (y >= max(clip_y, 0) && l <= b) {
+            _draw_rect_fast(l, y, b-l+1, 1, color); }
+          return; }
+        for (auto d = -r; d <= r; d++) {
+          auto row = y + d - top;
+          auto h = half[abs(d)];
+          lo[row] = min(lo[row], a-h);
+          hi[row] = max(hi[row], b+h); } };
+
       auto dx = abs(x1-x0);
       auto sx = x0<x1 ? 1 : -1;
       auto dy = -abs(y1-y0);
       auto sy = y0<y1 ? 1 : -1;
       auto err = dx+dy;
+      auto ra = x0, rb = x0;
       while (true) {
-        this->draw_circle(x0, y0, width/2, 1, color,true);
+        ra = min(ra, x0);
+        rb = max(rb, x0);
 
         if (x0==x1 && y0==y1) break;
         auto e2 = 2*err;
@@ -21544,8 +21716,159 @@ namespace framebuffer {
           err += dy;
           x0 += sx; }
         if (e2 <= dx) {
+          run(ra, rb, y0);
+          ra = rb = x0;
           err += dx;
-          y0 += sy; } } }
+          y0 += sy; } }
+      run(ra, rb, y0);
+      if (!r) {
+        return; }
+
+      for (auto row = max(clip_y-top, 0); row < rows; row++) {
+        auto y = top + row;
+        auto l = max(lo[row], 0);
+        if (y < 0 || l > hi[row]) {
+          continue; }
+        _draw_rect_fast(l, y, hi[row]-l+1, 1, color); } }
+    vector<int> span_lo, span_hi;
+
+    // a polyline as one shape, point(i, x, y, r) gives each point and its radius. every pair
+    // of points is the hull of their two circles, which makes round ends and joins. the spans of
+    // all the hulls are gathered by row first and merged so each pixel is written once, however
+    // often the line goes over itself, except thin lines of one radius which go a segment at a
+    // time. rows above clip_y are left alone
+    template<typename P>
+    void draw_polyline(int n, P point, int color, int clip_y=0) {
+      if (n <= 0) {
+        return; }
+      this->dirty = 1;
+      auto &pts = this->poly_pts;
+      pts.resize(n);
+      point(0, pts[0].x, pts[0].y, pts[0].r);
+      auto x0 = pts[0].x, y0 = pts[0].y, x1 = x0, y1 = y0;
+      auto rmin = pts[0].r, rmax = rmin;
+      for (auto i = 1; i < n; i++) {
+        auto &p = pts[i];
+        point(i, p.x, p.y, p.r);
+        x0 = min(x0, p.x); y0 = min(y0, p.y);
+        x1 = max(x1, p.x); y1 = max(y1, p.y);
+        rmin = min(rmin, p.r); rmax = max(rmax, p.r); }
+      auto pad = (int) rmax + 1;
+      update_dirty(dirty_area, x0-pad, y0-pad);
+      update_dirty(dirty_area, x1+pad, y1+pad);
+
+      // a thin line of one width hardly goes over itself, gathering its spans costs more than
+      // the few pixels written twice when it's drawn a segment at a time
+      auto r = (int) (rmax+0.5f);
+      if (r <= 1 && (int) (rmin+0.5f) == r) {
+        for (auto i = 1; i < max(n, 2); i++) {
+          auto &a = pts[i-1], &b = pts[min(i, n-1)];
+          _line_circle(a.x, a.y, b.x, b.y, r, color, clip_y); }
+        return; }
+
+      this->poly_top = max(max(y0-pad, clip_y), 0);
+      auto bottom = min(y1+pad, this->height-1);
+      if (this->poly_top > bottom) {
+        return; }
+      this->poly_rows.assign(bottom-this->poly_top+1, -1);
+      this->poly_spans.clear();
+      this->poly_hull = 0;
+
+      for (auto i = 1; i < max(n, 2); i++) {
+        auto &a = pts[i-1], &b = pts[min(i, n-1)];
+        _hull_spans(a.x, a.y, a.r, b.x, b.y, b.r, i == 1); }
+
+      auto &sp = this->poly_spans;
+      for (auto row = 0; row < (int) this->poly_rows.size(); row++) {
+        auto k = this->poly_rows[row];
+        if (k < 0) {
+          continue; }
+        if (sp[k].next < 0) {
+          _poly_fill(sp[k].x0, sp[k].x1, this->poly_top+row, color);
+          continue; }
+        // a row holds a few spans at most, they're sorted as they're gathered
+        auto &line = this->poly_line;
+        line.clear();
+        for (; k >= 0; k = sp[k].next) {
+          auto j = line.size();
+          line.push_back(sp[k]);
+          for (; j > 0 && line[j-1].x0 > sp[k].x0; j--) {
+            line[j] = line[j-1]; }
+          line[j] = sp[k]; }
+        for (size_t j = 0; j < line.size(); ) {
+          auto s = line[j++];
+          while (j < line.size() && line[j].x0 <= s.x1+1) {
+            s.x1 = max(s.x1, line[j++].x1); }
+          _poly_fill(s.x0, s.x1, this->poly_top+row, color); } } }
+
+    inline void _poly_fill(int x0, int x1, int y, int color) {
+      auto lo = max(x0, 0);
+      if (lo <= x1) {
+        _draw_rect_fast(lo, y, x1-lo+1, 1, color); } }
+
+    // the spans of one segment: a circle at every bresenham step, its radius going from ra to
+    // rb along the way, which fills the hull of the circles at either end as closely as pixels
+    // allow. steps on the same row with the same radius are one run. the first point's circle
+    // is the end of the segment before, so only the first segment draws it
+    void _hull_spans(int ax, int ay, float ra, int bx, int by, float rb, bool first) {
+      auto r0 = (int) (ra+0.5f), r1 = (int) (rb+0.5f);
+      this->poly_hull++;
+      auto top = this->poly_top, bottom = top+(int) this->poly_rows.size()-1;
+      auto run = [&](int a, int b, int y, int r) {
+        auto &h = get_circle_spans(r);
+        for (auto d = max(-r, top-y); d <= min(r, bottom-y); d++) {
+          _poly_span(y+d, a-h[abs(d)], b+h[abs(d)]); } };
+
+      auto dx = abs(bx-ax);
+      auto sx = ax<bx ? 1 : -1;
+      auto dy = -abs(by-ay);
+      auto sy = ay<by ? 1 : -1;
+      auto err = dx+dy;
+      auto steps = max(dx, -dy), k = 0;
+      auto x = ax, y = ay;
+      auto run_r = -1, run_y = 0, run_x0 = 0, run_x1 = 0;
+      while (true) {
+        auto r = r0 == r1 || !steps ? r0 : (r0*(steps-k) + r1*k + steps/2)/steps;
+        if (k || first) {
+          if (r != run_r || y != run_y) {
+            if (run_r >= 0) {
+              run(run_x0, run_x1, run_y, run_r); }
+            run_r = r;
+            run_y = y;
+            run_x0 = run_x1 = x; }
+          run_x0 = min(run_x0, x);
+          run_x1 = max(run_x1, x); }
+
+        if (x==bx && y==by) break;
+        auto e2 = 2*err;
+        if (e2 >= dy) {
+          err += dy;
+          x += sx; }
+        if (e2 <= dx) {
+          err += dx;
+          y += sy; }
+        k++; }
+      if (run_r >= 0) {
+        run(run_x0, run_x1, run_y, run_r); } }
+
+    // the last span on a row is usually the previous hull's and they mostly overlap. a hull is
+    // convex, so whatever one hull puts on a row is a single span, gaps between its runs filled
+    inline void _poly_span(int y, int l, int h) {
+      auto &head = this->poly_rows[y-this->poly_top];
+      if (head >= 0) {
+        auto &s = this->poly_spans[head];
+        if (s.hull == this->poly_hull || (l <= s.x1+1 && h >= s.x0-1)) {
+          s.x0 = min(s.x0, l);
+          s.x1 = max(s.x1, h);
+          s.hull = this->poly_hull;
+          return; } }
+      this->poly_spans.push_back(FBSpan{head, l, h, this->poly_hull});
+      head = (int) this->poly_spans.size()-1; }
+
+    vector<FBSpan> poly_spans, poly_line;
+    vector<int> poly_rows; // the last span on each row from poly_top down
+    vector<FBPolyPoint> poly_pts;
+    int poly_top = 0, poly_hull = 0;
 
 
 
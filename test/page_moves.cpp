@@ -0,0 +1,78 @@
+// moves pages around one document and another and checks undo and redo put them back.
+// builds against main.cpp with its main renamed, make test runs it on a scratch notes.db
+#define main remarked_main
+#include "../main.cpp"
+#undef main
+
+int failed = 0;
+
+// each page is told apart by the x of the one stroke drawn on it
+void mark(grid& g,const std::string& file,int page,int tag){
+  g.load(file,page);
+  stroke st;
+  st.width = 2;
+  st.begin(g.cur.pts,tag*10,100);
+  st.add(g.cur.pts,tag*10,200);
+  g.add(st);
+  g.save();
+}
+
+std::string order(grid& g,const std::string& file,int n){
+  std::string s;
+  for (int i = 0 ; i < n ; i++){
+    g.load(file,i);
+    int tag = 0;
+    g.cur.strokes.all([&](stroke& st){ tag = st.x/10; });
+    s += tag ? (char)('0'+tag) : '.';
+  }
+  return s;
+}
+
+void expect(grid& g,const char* what,const std::string& file,const std::string& want){
+  std::string got = order(g,file,want.size());
+  if (got != want){
+    std::cerr << what << ": " << file << " is " << got << ", wanted " << want << "\n";
+    failed++;
+  }
+}
+
+// moves from:fp to to:tp in a fresh pair of documents and checks the result, then undo and redo
+void check(grid& g,int fp,const char* to,int tp,const std::string& moved,const std::string& other){
+  static int run = 0;
+  std::string a = "A" + std::to_string(run), b = "B" + std::to_string(run);
+  run++;
+  for (int i = 0 ; i < 5 ; i++)
+    mark(g,a,i,i+1);
+  std::string dest = to[0] == 'A' ? a : b;
+  g.move(a,fp,dest,tp);
+  std::string what = "move A:" + std::to_string(fp) + " to " + to + ":" + std::to_string(tp);
+  expect(g,what.c_str(),a,moved);
+  if (dest == b) expect(g,what.c_str(),b,other);
+  box area;
+  g.undo(area);
+  expect(g,(what+", undone").c_str(),a,"12345");
+  g.redo(area);
+  expect(g,(what+", redone").c_str(),a,moved);
+  if (dest == b) expect(g,(what+", redone").c_str(),b,other);
+}
+
+int main(int argc,char** argv){
+  db_path = argc > 1 ? argv[1] : "page_moves.db";
+  remove(db_path);
+  grid g;
+  g.init(1824,48,new framebuffer::VirtualFB(1404,1872));
+  // down its own document the page lands in front of what was at to_page
+  check(g,0,"A",3,"23145","");
+  check(g,1,"A",4,"13425","");
+  check(g,0,"A",5,"23451","");
+  // and up it
+  check(g,3,"A",0,"41235","");
+  check(g,4,"A",1,"15234","");
+  // another document
+  check(g,2,"B",0,"1245","3");
+  check(g,0,"B",2,"2345","..1");
+  g.close();
+  remove(db_path);
+  printf("page moves %s\n",failed ? "failed" : "ok");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+// fill_row and copy_row against a pixel at a time, for every length up to a few vector widths past the
+// tail and every alignment of the destination, with guard pixels either side that must not change.
+// builds against rmkit.h, make test runs it; on the device that is the NEON path
+#include "../rmkit.h"
+
+const int max_n = 100, guard = 8, max_off = 16;
+
+int failed = 0;
+
+void compare(const char* what,int n,int off,const remarkable_color* got,const remarkable_color* want){
+  for (int i = 0 ; i < max_n+2*guard+max_off ; i++)
+    if (got[i] != want[i]){
+      fprintf(stderr,"%s: n %d offset %d differs at %d\n",what,n,off,i-guard-off);
+      failed++;
+      return;
+    }
+}
+
+int main(){
+  remarkable_color got[max_n+2*guard+max_off], want[max_n+2*guard+max_off], src[max_n+max_off];
+  for (int i = 0 ; i < max_n+max_off ; i++)
+    src[i] = (remarkable_color)(i*40503+7);
+  for (remarkable_color c : {BLACK,WHITE,GRAY,(remarkable_color)0x1234})
+    for (int n = 0 ; n <= max_n ; n++)
+      for (int off = 0 ; off < max_off ; off++){
+        for (int i = 0 ; i < max_n+2*guard+max_off ; i++)
+          got[i] = want[i] = (remarkable_color)(0x5a5a+i);
+        framebuffer::fill_row(got+guard+off,n,c);
+        for (int i = 0 ; i < n ; i++)
+          want[guard+off+i] = c;
+        compare("fill_row",n,off,got,want);
+      }
+  for (int n = 0 ; n <= max_n ; n++)
+    for (int off = 0 ; off < max_off ; off++)
+      for (int soff = 0 ; soff < max_off ; soff += 3){
+        for (int i = 0 ; i < max_n+2*guard+max_off ; i++)
+          got[i] = want[i] = (remarkable_color)(0x5a5a+i);
+        framebuffer::copy_row(got+guard+off,src+soff,n);
+        for (int i = 0 ; i < n ; i++)
+          want[guard+off+i] = src[soff+i];
+        compare("copy_row",n,off,got,want);
+      }
+  printf("row kernels %s\n",failed ? "failed" : "ok");
+  return failed ? 1 : 0;
+}